@@ -5,76 +5,262 @@
 #include "riscv_sim_framework.h"
 #include "mem.h"
 #include "TLB.h"
+#include "plugin_host.h"
+#include "hostprofile.h"
 
-// Notes on structure: the TLB is restricted to 8 entries - therefore addresses will be indexed on bits [4 : 2].
+// Notes on structure: the TLB has num_sets x ways entries and is indexed on the 16KB virtual page, bits [31 : 14],
+// with LRU replacement inside a set (ways == number of entries gives a fully associative TLB).
+// First-level PTEs read by a walk are kept in a small fully associative page-walk cache, so a miss to an already
+// walked 4MB region only needs the second-level read.
+// With a second-level TLB attached, an L1 miss first spends l2->latency cycles looking it up (status 3) and only
+// walks the page table if that misses too. Walks fill both levels.
+// A first-level PTE with bit 30 set maps a whole 4MB superpage (physical base in the same format as a table pointer,
+// 4MB aligned) and ends the walk early. Superpage entries share the TLB with 16KB ones but are indexed on bits
+// [31 : 22], so a lookup probes the set of each page size.
+// Entries and page-walk cache entries are tagged with the ASID of the PTBR they were walked under and only match
+// while that ASID is current, so switching page tables needs no flush.
 
-uint8_t update_tlb_entry(struct tlb* cache, uint32_t tlb_index, uint32_t virtual_page /* :20 */, uint32_t* ret_physical_page, uint8_t status) {
+void construct_tlb(struct tlb* cache, uint32_t num_entries, uint32_t ways, uint32_t walk_cache_entries) {
+    if (ways > num_entries) {
+        ways = num_entries; // fully associative
+    }
+    if (ways == 0 || num_entries % ways != 0 || ((num_entries / ways) & (num_entries / ways - 1)) != 0) {
+        printf("TLB needs a power of 2 number of sets, not %u entries with %u ways\n", num_entries, ways);
+        exit(1);
+    }
+    cache->num_sets = num_entries / ways;
+    cache->ways = ways;
+    cache->entries = scalloc(num_entries * sizeof(struct tlb_entry));
+    cache->walk_cache_entries = walk_cache_entries;
+    cache->walk_cache = walk_cache_entries ? scalloc(walk_cache_entries * sizeof(struct walk_cache_entry)) : NULL;
+    cache->clock = 0;
+    cache->cached_second_index = 0;
+    cache->l2 = NULL;
+    cache->latency = 0;
+    cache->l2_wait = 0;
+    cache->l2_hit = 0;
+    memset(&cache->l2_entry, 0, sizeof(struct tlb_entry));
+    cache->accesses = 0;
+    cache->misses = 0;
+}
+
+struct tlb_entry* tlb_lookup(struct tlb* cache, uint32_t virtual_address) {
+    uint16_t asid = PTBR_ASID(get_ptbr());
+    for (uint8_t huge = 0; huge < 2; huge++) {
+        uint32_t virtual_page = virtual_address >> (huge ? 22 : 14);
+        struct tlb_entry* set = &cache->entries[(virtual_page & (cache->num_sets - 1)) * cache->ways];
+        for (uint32_t i = 0; i < cache->ways; i++) {
+            if (set[i].valid && set[i].huge == huge && set[i].virtual_page == virtual_page && set[i].asid == asid) {
+                set[i].last_used = ++cache->clock;
+                return &set[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+uint32_t tlb_translate(const struct tlb_entry* entry, uint32_t virtual_address) {
+    if (entry->huge) {
+        return (entry->physical_page << 14) | (virtual_address << 10 >> 10);
+    }
+    return (entry->physical_page << 14) | (virtual_address << 18 >> 18);
+}
+
+// Entry to replace in the set of virtual_page - first invalid way, else least recently used
+struct tlb_entry* tlb_victim(struct tlb* cache, uint32_t virtual_page) {
+    struct tlb_entry* set = &cache->entries[(virtual_page & (cache->num_sets - 1)) * cache->ways];
+    struct tlb_entry* victim = &set[0];
+    for (uint32_t i = 0; i < cache->ways; i++) {
+        if (!set[i].valid) {
+            return &set[i];
+        }
+        if (set[i].last_used < victim->last_used) {
+            victim = &set[i];
+        }
+    }
+    return victim;
+}
+
+void tlb_fill(struct tlb* cache, const struct tlb_entry* translation) {
+    struct tlb_entry* entry = tlb_victim(cache, translation->virtual_page);
+    *entry = *translation;
+    entry->valid = 1;
+    entry->last_used = ++cache->clock;
+}
+
+struct walk_cache_entry* walk_cache_find(struct tlb* cache, uint32_t root_index) {
+    uint16_t asid = PTBR_ASID(get_ptbr());
+    for (uint32_t i = 0; i < cache->walk_cache_entries; i++) {
+        if (cache->walk_cache[i].valid && cache->walk_cache[i].root_index == root_index && cache->walk_cache[i].asid == asid) {
+            cache->walk_cache[i].last_used = ++cache->clock;
+            return &cache->walk_cache[i];
+        }
+    }
+    return NULL;
+}
+
+void walk_cache_insert(struct tlb* cache, uint32_t root_index, uint32_t pte) {
+    if (cache->walk_cache_entries == 0) {
+        return;
+    }
+    struct walk_cache_entry* victim = &cache->walk_cache[0];
+    for (uint32_t i = 0; i < cache->walk_cache_entries; i++) {
+        if (!cache->walk_cache[i].valid) {
+            victim = &cache->walk_cache[i];
+            break;
+        }
+        if (cache->walk_cache[i].last_used < victim->last_used) {
+            victim = &cache->walk_cache[i];
+        }
+    }
+    victim->valid = 1;
+    victim->root_index = (uint16_t) root_index;
+    victim->asid = PTBR_ASID(get_ptbr());
+    victim->pte = pte;
+    victim->last_used = ++cache->clock;
+}
+
+uint8_t update_tlb_entry(struct tlb* cache, uint32_t virtual_address, struct tlb_entry* ret_entry, uint8_t status) {
+    uint32_t virtual_page = virtual_address >> 12;
     uint32_t virtual_superpage = virtual_page >> 2;
+    uint32_t root_index = virtual_superpage >> 8;
     // split virtual address into upper and lower
-    uint32_t first_level_index = (virtual_superpage >> 8 << 2) + get_ptbr();
+    uint32_t first_level_index = (root_index << 2) + PTBR_ROOT(get_ptbr());
     uint32_t second_level_index;
     bool memory_direct_status = false;
+    struct walk_cache_entry* walked;
+
+    if (status == 0xFF && (walked = walk_cache_find(cache, root_index)) != NULL) {
+        cache->cached_second_index = walked->pte;
+        status = 2; // first level already known, go straight to the second-level read
+    }
 
     if (status == 0 && !(memory_direct_status = memory_status(first_level_index, &second_level_index))) {
         return 0;
     } else if (status == 0xFF && !(memory_direct_status = memory_read(first_level_index, &second_level_index, 4))) {
         return 0;
     }
-    if (memory_direct_status) {
-        cache->cached_second_index = second_level_index;
-        return 2; // only one read per stage
+    if (memory_direct_status && second_level_index >> 30 == 0b11) { // superpage, no second level
+        if (second_level_index & 0x3FF) {
+            return 0x80; // misaligned superpage
+        }
+        memset(ret_entry, 0, sizeof(struct tlb_entry));
+        ret_entry->asid = PTBR_ASID(get_ptbr());
+        ret_entry->huge = 1;
+        ret_entry->virtual_page = root_index;
+        ret_entry->physical_page = (second_level_index << 2 >> 4) & 0x3FFFF;
     } else {
-        second_level_index = cache->cached_second_index;
-    }
+        if (memory_direct_status) {
+            cache->cached_second_index = second_level_index;
+            if (second_level_index >> 31 == 1) {
+                walk_cache_insert(cache, root_index, second_level_index);
+            }
+            return 2; // only one read per stage
+        } else {
+            second_level_index = cache->cached_second_index;
+        }
 
 
-    if (second_level_index >> 31 != 1) {
-        return 0x80;
-    }
+        if (second_level_index >> 31 != 1) {
+            return 0x80;
+        }
 
-    second_level_index = second_level_index << 1 >> 1 << 12;
+        second_level_index = second_level_index << 1 >> 1 << 12;
 
-    uint32_t physical_page;
+        uint32_t physical_page;
 
-    second_level_index += (virtual_page & 0xFF) << 2;
-    if (status != 1 && !memory_read(second_level_index, &physical_page, 4)) {
-        return 1;
-    } else if (status == 1 && !memory_status(second_level_index, &physical_page)) {
-        return 1;
-    }
+        second_level_index += (virtual_page & 0xFF) << 2;
+        if (status != 1 && !memory_read(second_level_index, &physical_page, 4)) {
+            return 1;
+        } else if (status == 1 && !memory_status(second_level_index, &physical_page)) {
+            return 1;
+        }
 
-    if (!(physical_page >> 31)) {
-        return 0x80; // invalid entry
+        if (!(physical_page >> 31)) {
+            return 0x80; // invalid entry
+        }
+        memset(ret_entry, 0, sizeof(struct tlb_entry));
+        ret_entry->asid = PTBR_ASID(get_ptbr());
+        ret_entry->virtual_page = virtual_superpage;
+        ret_entry->physical_page = (physical_page << 1 >> 3) & 0x3FFFF; // 18 bit physical page
     }
-    if (virtual_superpage >> 3 != tlb_index) {
-        printf("superpage tlb_index mismatch!\n");
-        exit(1);
+    tlb_fill(cache, ret_entry);
+    if (cache->l2 != NULL) {
+        tlb_fill(cache->l2, ret_entry);
     }
-    cache->entries[tlb_index].virtual_page = (uint16_t) (virtual_superpage >> 3);
-    cache->entries[tlb_index].physical_page = physical_page << 1 >> 3;
-    cache->entries[tlb_index].valid = 1;
-    *ret_physical_page = cache->entries[tlb_index].physical_page;
     return 0xFF;
 }
 
-uint8_t get_address(struct tlb* cache, uint32_t virtual_address, uint32_t* output, uint8_t status) {
-    uint32_t index = (virtual_address >> 14) & 0b111;
+static uint8_t translate_address(struct tlb* cache, uint32_t virtual_address, uint32_t* output, uint8_t status) {
+    struct tlb_entry* entry;
+    struct tlb_entry walked_entry;
     uint8_t new_status;
-    uint32_t ret_physical_page;
     if (status == 0xFF) {
-        if (virtual_address >> 17 == cache->entries[index].virtual_page && cache->entries[index].valid) { // found
-            *output = (cache->entries[index].physical_page << 14) | (virtual_address << 18 >> 18);
+        cache->accesses++;
+        if ((entry = tlb_lookup(cache, virtual_address)) != NULL) { // found
+            *output = tlb_translate(entry, virtual_address);
             return 0xFE;
-        } else { // not found
-            if ((new_status = update_tlb_entry(cache, index, virtual_address >> 12, &ret_physical_page, 0xFF)) != 0xFF) {
-                return new_status;
+        }
+        cache->misses++;
+        if (plugin_hooks & PLUGIN_HOOK_TLB_MISS) {
+            plugin_tlb_miss(cache, virtual_address);
+        }
+        if (cache->l2 != NULL) { // not found, look in the second-level TLB before walking
+            entry = tlb_lookup(cache->l2, virtual_address);
+            cache->l2_hit = (uint8_t) (entry != NULL);
+            if (entry != NULL) {
+                cache->l2_entry = *entry;
             }
+            cache->l2_wait = cache->l2->latency;
+            status = 3;
         }
-    } else {
-        if ((new_status = update_tlb_entry(cache, index, virtual_address >> 12, &ret_physical_page, status)) != 0xFF) {
-            return new_status;
+    }
+    if (status == 3) {
+        if (cache->l2_wait > 0) {
+            cache->l2_wait--;
+            return 3;
         }
+        if (cache->l2_hit) {
+            tlb_fill(cache, &cache->l2_entry);
+            *output = tlb_translate(&cache->l2_entry, virtual_address);
+            return 0xFE;
+        }
+        status = 0xFF; // missed in both levels, start the walk
+    }
+    if ((new_status = update_tlb_entry(cache, virtual_address, &walked_entry, status)) != 0xFF) {
+        return new_status;
     }
-    *output = (ret_physical_page << 14) | (virtual_address << 18 >> 18);
+    *output = tlb_translate(&walked_entry, virtual_address);
     return 0xFF;
-}
\ No newline at end of file
+}
+
+uint8_t get_address(struct tlb* cache, uint32_t virtual_address, uint32_t* output, uint8_t status) {
+    uint8_t new_status;
+    HOSTPROFILE_TIME(HOSTPROFILE_GET_ADDRESS, new_status = translate_address(cache, virtual_address, output, status));
+    return new_status;
+}
+
+// Invalidates the translations of one ASID and/or one virtual address (-1 matches any), like sfence.vma.
+// Page-walk cache entries covering the address are dropped too, in case the first-level PTE changed.
+void tlb_flush(struct tlb* cache, int32_t asid, int64_t virtual_address) {
+    for (uint32_t i = 0; i < cache->num_sets * cache->ways; i++) {
+        struct tlb_entry* entry = &cache->entries[i];
+        if (asid >= 0 && entry->asid != asid) {
+            continue;
+        }
+        if (virtual_address >= 0 && entry->virtual_page != (uint32_t) virtual_address >> (entry->huge ? 22 : 14)) {
+            continue;
+        }
+        entry->valid = 0;
+    }
+    for (uint32_t i = 0; i < cache->walk_cache_entries; i++) {
+        struct walk_cache_entry* entry = &cache->walk_cache[i];
+        if (asid >= 0 && entry->asid != asid) {
+            continue;
+        }
+        if (virtual_address >= 0 && entry->root_index != (uint32_t) virtual_address >> 22) {
+            continue;
+        }
+        entry->valid = 0;
+    }
+}
@@ -6,18 +6,47 @@
 # include <string.h>
 # include <math.h>
 
+// The extended PTBR holds the page table root in bits [31 : 0] and the address-space identifier in bits [47 : 32]
+# define PTBR_ROOT(ptbr) ((uint32_t) ((ptbr) & 0xFFFFFFFFULL))
+# define PTBR_ASID(ptbr) ((uint16_t) ((ptbr) >> 32 & 0xFFFF))
 
 struct tlb_entry {
     uint8_t valid:1;
+    uint8_t huge:1; // 4MB superpage, virtual_page holds address bits [31 : 22]
     uint32_t physical_page:18;
-    uint16_t virtual_page:15;
+    uint32_t virtual_page:18;
+    uint16_t asid;
+    uint64_t last_used;
+};
+
+// page-walk cache entry, holds a first-level PTE
+struct walk_cache_entry {
+    uint8_t valid:1;
+    uint16_t root_index:10;
+    uint16_t asid;
+    uint32_t pte;
+    uint64_t last_used;
 };
 
 struct tlb {
-    struct tlb_entry entries[8];
+    struct tlb_entry* entries;
+    uint32_t num_sets;
+    uint32_t ways;
+    struct walk_cache_entry* walk_cache;
+    uint32_t walk_cache_entries;
+    uint64_t clock;
     uint32_t cached_second_index;
+    struct tlb* l2; // shared second-level TLB consulted before walking, NULL when there is none
+    uint32_t latency; // lookup latency in cycles when used as a second-level TLB
+    uint32_t l2_wait;
+    uint8_t l2_hit;
+    struct tlb_entry l2_entry;
+    uint64_t accesses; // translations looked up, not counting the cycles spent waiting on a miss
+    uint64_t misses; // lookups that had to go to the second-level TLB or walk the page table
 };
 
+void construct_tlb(struct tlb* cache, uint32_t num_entries, uint32_t ways, uint32_t walk_cache_entries);
 uint8_t get_address(struct tlb* cache, uint32_t virtual_address, uint32_t* output, uint8_t status);
+void tlb_flush(struct tlb* cache, int32_t asid, int64_t virtual_address);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,52 +1,468 @@
 #include "branch_predictor.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "mem.h"
+#include "hart.h"
 
+// Notes on structure: the BTB only holds targets. It has num_sets x ways entries indexed on the word address
+// (pc >> 2) and tagged with BTB_TAG_BITS of the bits above the index, with LRU replacement inside a set.
+// Partial tags can alias; a wrong target is caught like any other mispredict in execute.
+// Conditional branches that hit take their direction from the direction predictor.
+// Calls (jal/jalr with rd = ra) push their return address on a circular return address stack at fetch and returns
+// (jalr x0, ra) pop it, so the stack is speculative. Every fetched instruction carries the stack top from before its
+// own push/pop, which is restored when younger instructions are refetched or squashed.
+// Other jalrs (jump tables, function pointers) look up a tagged target table indexed by their PC hashed with the path
+// history, the low bits of the last path_length indirect targets, before falling back to the BTB.
+// All of the predictor state is per hart.
 
-struct branch_information_entry {
-    uint64_t branch_address; // Address of the branch instruction
-    uint64_t target_address; // Target destination of the address instruction
-    uint8_t bht; // 2 bit branch history table
+HART_LOCAL struct btb btb;
+
+HART_LOCAL uint64_t* return_stack = NULL;
+HART_LOCAL uint32_t return_stack_entries = 0;
+HART_LOCAL uint32_t return_stack_top = 0;
+
+struct indirect_entry {
+    uint8_t valid : 1;
+    uint8_t confidence : 2; // replaced only once this has dropped to 0
+    uint16_t tag;
+    uint64_t target_address;
+};
+
+HART_LOCAL struct indirect_entry* indirect_table = NULL;
+HART_LOCAL uint32_t indirect_entries = 0;
+HART_LOCAL uint8_t indirect_index_bits = 0;
+HART_LOCAL uint8_t path_bits = 0;
+HART_LOCAL uint64_t path_history = 0;
+
+HART_LOCAL uint64_t branch_history = 0;
+HART_LOCAL uint64_t history_mask = 0;
+HART_LOCAL uint8_t history_bits = 0;
+HART_LOCAL uint64_t table_mask = 0;
+HART_LOCAL uint8_t index_bits = 0;
+HART_LOCAL struct direction_predictor* direction_predictor = NULL;
+
+// 2 bit saturating counters, taken when > 1
+HART_LOCAL uint8_t* bimodal_counters = NULL;
+HART_LOCAL uint8_t* gshare_counters = NULL;
+HART_LOCAL uint8_t* chooser_counters = NULL; // tournament: > 1 picks gshare over bimodal
+
+struct tage_entry {
+    uint16_t tag;
+    int8_t counter; // 3 bit signed, taken when >= 0
+    uint8_t useful; // 2 bits
 };
 
-struct branch_information_entry branch_table[32];
+HART_LOCAL struct tage_entry* tage_tables[TAGE_TABLES];
+HART_LOCAL uint8_t tage_history_length[TAGE_TABLES];
+HART_LOCAL uint64_t tage_updates = 0;
 
-void update_bht(uint8_t t_bht, uint8_t t_index) {
-    if ( (t_bht) && (branch_table[t_index].bht < 3) ) {
-        branch_table[t_index].bht++;
+void update_counter(uint8_t* counter, uint8_t taken) {
+    if (taken && *counter < 3) {
+        (*counter)++;
+    } else if (!taken && *counter > 0) {
+        (*counter)--;
     }
-    else if ( (!t_bht) && (branch_table[t_index].bht > 0) ) {
-        branch_table[t_index].bht--;
+}
+
+// xors the youngest length bits of history down to bits bits
+uint64_t fold_history(uint64_t history, uint8_t length, uint8_t bits) {
+    uint64_t folded = 0;
+    if (length < 64) {
+        history &= ((uint64_t) 1 << length) - 1;
+    }
+    while (history) {
+        folded ^= history & (((uint64_t) 1 << bits) - 1);
+        history >>= bits;
     }
+    return folded;
+}
+
+uint64_t bimodal_index(uint64_t pc) {
+    return (pc >> 2) & table_mask;
+}
+
+uint64_t gshare_index(uint64_t pc, uint64_t history) {
+    return ((pc >> 2) ^ fold_history(history, history_bits, index_bits)) & table_mask;
+}
+
+uint8_t bimodal_predict(uint64_t pc, uint64_t history) {
+    return bimodal_counters[bimodal_index(pc)] > 1;
+}
+
+void bimodal_update(uint64_t pc, uint64_t history, uint8_t taken) {
+    update_counter(&bimodal_counters[bimodal_index(pc)], taken);
+}
+
+uint8_t gshare_predict(uint64_t pc, uint64_t history) {
+    return gshare_counters[gshare_index(pc, history)] > 1;
 }
 
-uint64_t predict_address(uint64_t branch_address) {
-    uint8_t t_index = (uint8_t) branch_address & 31;
-    if ( (branch_address == branch_table[t_index].branch_address) && (branch_table[t_index].bht > 1) ) {
-        return branch_table[t_index].target_address;
+void gshare_update(uint64_t pc, uint64_t history, uint8_t taken) {
+    update_counter(&gshare_counters[gshare_index(pc, history)], taken);
+}
+
+uint8_t tournament_predict(uint64_t pc, uint64_t history) {
+    if (chooser_counters[bimodal_index(pc)] > 1) {
+        return gshare_predict(pc, history);
     }
-    return branch_address + 4;
+    return bimodal_predict(pc, history);
 }
 
-uint64_t predict_address_BTFNT(uint64_t branch_address) {
-    uint8_t t_index = (uint8_t) branch_address & 31;
-    if (branch_table[t_index].branch_address == branch_address && branch_table[t_index].target_address > branch_address + 4) {
-        return branch_table[t_index].target_address;
+void tournament_update(uint64_t pc, uint64_t history, uint8_t taken) {
+    uint8_t bimodal_correct = bimodal_predict(pc, history) == taken;
+    uint8_t gshare_correct = gshare_predict(pc, history) == taken;
+    if (bimodal_correct != gshare_correct) {
+        update_counter(&chooser_counters[bimodal_index(pc)], gshare_correct);
     }
-    return branch_address + 4;
+    bimodal_update(pc, history, taken);
+    gshare_update(pc, history, taken);
+}
+
+uint64_t tage_index(uint64_t pc, uint64_t history, uint8_t table) {
+    return ((pc >> 2) ^ (pc >> (2 + index_bits)) ^ fold_history(history, tage_history_length[table], index_bits) ^ table) & table_mask;
+}
+
+uint16_t tage_tag(uint64_t pc, uint64_t history, uint8_t table) {
+    uint64_t tag = (pc >> 2) ^ fold_history(history, tage_history_length[table], TAGE_TAG_BITS) ^ (fold_history(history, tage_history_length[table], TAGE_TAG_BITS - 1) << 1);
+    return (uint16_t) (tag & ((1 << TAGE_TAG_BITS) - 1));
+}
+
+// finds the longest (provider) and second longest (alternate) matching tables, -1 for none
+void tage_lookup(uint64_t pc, uint64_t history, int8_t* provider, int8_t* alternate) {
+    *provider = -1;
+    *alternate = -1;
+    for (int8_t i = TAGE_TABLES - 1; i >= 0; i--) {
+        if (tage_tables[i][tage_index(pc, history, (uint8_t) i)].tag == tage_tag(pc, history, (uint8_t) i)) {
+            if (*provider == -1) {
+                *provider = i;
+            } else {
+                *alternate = i;
+                return;
+            }
+        }
+    }
+}
+
+uint8_t tage_table_predict(uint64_t pc, uint64_t history, int8_t table) {
+    if (table == -1) {
+        return bimodal_predict(pc, history);
+    }
+    return tage_tables[table][tage_index(pc, history, (uint8_t) table)].counter >= 0;
+}
+
+uint8_t tage_predict(uint64_t pc, uint64_t history) {
+    int8_t provider, alternate;
+    tage_lookup(pc, history, &provider, &alternate);
+    return tage_table_predict(pc, history, provider);
+}
+
+void tage_update(uint64_t pc, uint64_t history, uint8_t taken) {
+    int8_t provider, alternate;
+    tage_lookup(pc, history, &provider, &alternate);
+    uint8_t prediction = tage_table_predict(pc, history, provider);
+    if (provider == -1) {
+        bimodal_update(pc, history, taken);
+    } else {
+        struct tage_entry* entry = &tage_tables[provider][tage_index(pc, history, (uint8_t) provider)];
+        if (prediction != tage_table_predict(pc, history, alternate)) {
+            if (prediction == taken && entry->useful < 3) {
+                entry->useful++;
+            } else if (prediction != taken && entry->useful > 0) {
+                entry->useful--;
+            }
+        }
+        if (taken && entry->counter < 3) {
+            entry->counter++;
+        } else if (!taken && entry->counter > -4) {
+            entry->counter--;
+        }
+    }
+    // allocate in a longer history table on a mispredict, or age the candidates if none is free
+    if (prediction != taken && provider < TAGE_TABLES - 1) {
+        uint8_t allocated = 0;
+        for (int8_t i = (int8_t) (provider + 1); i < TAGE_TABLES && !allocated; i++) {
+            struct tage_entry* entry = &tage_tables[i][tage_index(pc, history, (uint8_t) i)];
+            if (entry->useful == 0) {
+                entry->tag = tage_tag(pc, history, (uint8_t) i);
+                entry->counter = (int8_t) (taken ? 0 : -1);
+                allocated = 1;
+            }
+        }
+        for (int8_t i = (int8_t) (provider + 1); i < TAGE_TABLES && !allocated; i++) {
+            struct tage_entry* entry = &tage_tables[i][tage_index(pc, history, (uint8_t) i)];
+            if (entry->useful > 0) {
+                entry->useful--;
+            }
+        }
+    }
+    if (++tage_updates % TAGE_USEFUL_RESET_PERIOD == 0) {
+        for (int i = 0; i < TAGE_TABLES; i++) {
+            for (uint64_t j = 0; j <= table_mask; j++) {
+                tage_tables[i][j].useful >>= 1;
+            }
+        }
+    }
+}
+
+struct direction_predictor direction_predictors[] = {
+    [BP_BIMODAL] = {"bimodal", bimodal_predict, bimodal_update},
+    [BP_GSHARE] = {"gshare", gshare_predict, gshare_update},
+    [BP_TOURNAMENT] = {"tournament", tournament_predict, tournament_update},
+    [BP_TAGE] = {"tage", tage_predict, tage_update},
+};
+
+uint8_t* construct_counters() {
+    uint8_t* counters = smalloc(table_mask + 1);
+    memset(counters, 1, table_mask + 1); // weakly not taken
+    return counters;
+}
+
+void construct_branch_predictor(uint8_t type, uint8_t table_bits, uint8_t history_length) {
+    if (type > BP_TAGE) {
+        printf("unknown branch predictor type %u\n", type);
+        exit(1);
+    }
+    if (table_bits < 1 || table_bits > 24 || history_length > 64) {
+        printf("branch predictor needs 1 to 24 table bits and at most 64 history bits, not %u and %u\n", table_bits, history_length);
+        exit(1);
+    }
+    // drop the tables of a previous predictor, the replay driver builds one after another
+    free(bimodal_counters);
+    free(gshare_counters);
+    free(chooser_counters);
+    gshare_counters = NULL;
+    chooser_counters = NULL;
+    for (int i = 0; i < TAGE_TABLES; i++) {
+        free(tage_tables[i]);
+        tage_tables[i] = NULL;
+    }
+    tage_updates = 0;
+    branch_history = 0;
+    direction_predictor = &direction_predictors[type];
+    index_bits = table_bits;
+    table_mask = ((uint64_t) 1 << table_bits) - 1;
+    history_bits = history_length;
+    history_mask = history_length == 64 ? (uint64_t) -1 : ((uint64_t) 1 << history_length) - 1;
+    bimodal_counters = construct_counters();
+    if (type == BP_GSHARE || type == BP_TOURNAMENT) {
+        gshare_counters = construct_counters();
+    }
+    if (type == BP_TOURNAMENT) {
+        chooser_counters = construct_counters();
+    }
+    if (type == BP_TAGE) {
+        // geometric history lengths, the last table sees the whole history
+        for (int i = 0; i < TAGE_TABLES; i++) {
+            tage_history_length[i] = (uint8_t) (history_length >> (TAGE_TABLES - 1 - i));
+            tage_tables[i] = scalloc((table_mask + 1) * sizeof(struct tage_entry));
+            for (uint64_t j = 0; j <= table_mask; j++) {
+                tage_tables[i][j].tag = (uint16_t) -1; // never matches a TAGE_TAG_BITS tag
+            }
+        }
+    }
+}
+
+void construct_btb(uint32_t num_entries, uint32_t ways) {
+    if (ways > num_entries) {
+        ways = num_entries; // fully associative
+    }
+    if (ways == 0 || num_entries % ways != 0 || ((num_entries / ways) & (num_entries / ways - 1)) != 0) {
+        printf("BTB needs a power of 2 number of sets, not %u entries with %u ways\n", num_entries, ways);
+        exit(1);
+    }
+    btb.num_sets = num_entries / ways;
+    btb.ways = ways;
+    free(btb.entries); // rebuilt for every predictor the replay driver runs
+    btb.entries = scalloc(num_entries * sizeof(struct btb_entry));
+    btb.clock = 0;
+}
+
+struct btb_entry* btb_set(uint64_t branch_address) {
+    return &btb.entries[((branch_address >> 2) & (btb.num_sets - 1)) * btb.ways];
+}
+
+uint16_t btb_tag(uint64_t branch_address) {
+    return (uint16_t) ((branch_address >> 2) / btb.num_sets & ((1 << BTB_TAG_BITS) - 1));
+}
+
+struct btb_entry* btb_lookup(uint64_t branch_address) {
+    struct btb_entry* set = btb_set(branch_address);
+    uint16_t tag = btb_tag(branch_address);
+    for (uint32_t i = 0; i < btb.ways; i++) {
+        if (set[i].valid && set[i].tag == tag) {
+            set[i].last_used = ++btb.clock;
+            return &set[i];
+        }
+    }
+    return NULL;
+}
+
+void construct_ras(uint32_t num_entries) {
+    return_stack_entries = num_entries;
+    free(return_stack);
+    return_stack = num_entries ? scalloc(num_entries * sizeof(uint64_t)) : NULL;
+    return_stack_top = 0;
+}
+
+void ras_checkpoint(uint32_t* top, uint64_t* value) {
+    *top = return_stack_top;
+    *value = return_stack_entries ? return_stack[return_stack_top] : 0;
+}
+
+// pushes for calls and pops for returns, returning the predicted return address (0 if none)
+uint64_t ras_update(uint64_t branch_address, uint32_t instruction) {
+    if (!return_stack_entries) {
+        return 0;
+    }
+    uint8_t opcode = (uint8_t) (instruction & 0x7F);
+    uint8_t rd = (uint8_t) (instruction >> 7 & 0x1F);
+    uint8_t rs1 = (uint8_t) (instruction >> 15 & 0x1F);
+    if ((opcode == 0b1101111 || opcode == 0b1100111) && rd == 1) {
+        return_stack_top = (return_stack_top + 1) % return_stack_entries;
+        return_stack[return_stack_top] = branch_address + 4;
+    } else if (opcode == 0b1100111 && rd == 0 && rs1 == 1) {
+        uint64_t return_address = return_stack[return_stack_top];
+        return_stack_top = (return_stack_top + return_stack_entries - 1) % return_stack_entries;
+        return return_address;
+    }
+    return 0;
+}
+
+// restores the stack to a checkpoint and replays the push/pop of the instruction it was taken before (0 for none)
+void ras_repair(uint32_t top, uint64_t value, uint64_t branch_address, uint32_t instruction) {
+    if (!return_stack_entries) {
+        return;
+    }
+    return_stack_top = top;
+    return_stack[top] = value;
+    ras_update(branch_address, instruction);
+}
+
+void construct_indirect_predictor(uint32_t num_entries, uint8_t path_length) {
+    if (num_entries & (num_entries - 1)) {
+        printf("indirect predictor size must be a power of 2, not %u\n", num_entries);
+        exit(1);
+    }
+    if (path_length * PATH_BITS_PER_TARGET > 64) {
+        printf("indirect predictor path history is at most %u targets, not %u\n", 64 / PATH_BITS_PER_TARGET, path_length);
+        exit(1);
+    }
+    indirect_entries = num_entries;
+    free(indirect_table);
+    path_history = 0;
+    indirect_table = num_entries ? scalloc(num_entries * sizeof(struct indirect_entry)) : NULL;
+    indirect_index_bits = 0;
+    while ((1u << indirect_index_bits) < num_entries) {
+        indirect_index_bits++;
+    }
+    path_bits = (uint8_t) (path_length * PATH_BITS_PER_TARGET);
+}
+
+// jalr other than a return
+uint8_t is_indirect_jump(uint32_t instruction) {
+    return (instruction & 0x7F) == 0b1100111 && !((instruction >> 7 & 0x1F) == 0 && (instruction >> 15 & 0x1F) == 1);
+}
+
+struct indirect_entry* indirect_lookup(uint64_t branch_address, uint64_t history, uint16_t* tag) {
+    uint64_t index = ((branch_address >> 2) ^ fold_history(history, path_bits, indirect_index_bits)) & (indirect_entries - 1);
+    *tag = (uint16_t) (((branch_address >> 2 >> indirect_index_bits) ^ fold_history(history, path_bits, INDIRECT_TAG_BITS - 1) << 1) & ((1 << INDIRECT_TAG_BITS) - 1));
+    return &indirect_table[index];
 }
 
-void update_entry(uint64_t new_address, uint64_t new_target, uint8_t t_bht) {
-    uint8_t t_index = (uint8_t) new_target & 31;
-    // Updates when entry is already present
-    if (branch_table[t_index].branch_address == new_target) {
-        update_bht(t_bht, t_index);
+// trains the indirect predictor with a resolved jalr and shifts its target into the path history
+void update_indirect(uint64_t branch_address, uint32_t instruction, uint64_t history, uint64_t target) {
+    if (!indirect_entries || !is_indirect_jump(instruction)) {
         return;
     }
+    uint16_t tag;
+    struct indirect_entry* entry = indirect_lookup(branch_address, history, &tag);
+    if (entry->valid && entry->tag == tag) {
+        if (entry->target_address == target) {
+            if (entry->confidence < 3) {
+                entry->confidence++;
+            }
+        } else if (entry->confidence > 0) {
+            entry->confidence--;
+        } else {
+            entry->target_address = target;
+        }
+    } else if (!entry->valid || entry->confidence == 0) {
+        entry->valid = 1;
+        entry->tag = tag;
+        entry->target_address = target;
+        entry->confidence = 1;
+    } else {
+        entry->confidence--;
+    }
+    path_history = path_history << PATH_BITS_PER_TARGET | (target >> 2 & ((1 << PATH_BITS_PER_TARGET) - 1));
+}
+
+uint64_t predict_address(uint64_t branch_address, uint32_t instruction) {
+    uint64_t return_address = ras_update(branch_address, instruction);
+    if (return_address) {
+        return return_address;
+    }
+    if (indirect_entries && is_indirect_jump(instruction)) {
+        uint16_t tag;
+        struct indirect_entry* indirect = indirect_lookup(branch_address, path_history, &tag);
+        if (indirect->valid && indirect->tag == tag) {
+            return indirect->target_address;
+        }
+    }
+    struct btb_entry* entry = btb_lookup(branch_address);
+    if (entry != NULL && (!entry->conditional || direction_predictor->predict(branch_address, branch_history & history_mask))) {
+        return entry->target_address;
+    }
+    return branch_address + 4;
+}
+
+void update_entry(uint64_t new_address, uint64_t new_target, uint8_t conditional) {
+    struct btb_entry* entry = btb_lookup(new_address);
+    if (entry == NULL) {
+        // Creates new entry in an invalid way, else the least recently used one
+        struct btb_entry* set = btb_set(new_address);
+        entry = &set[0];
+        for (uint32_t i = 0; i < btb.ways; i++) {
+            if (!set[i].valid) {
+                entry = &set[i];
+                break;
+            }
+            if (set[i].last_used < entry->last_used) {
+                entry = &set[i];
+            }
+        }
+        entry->valid = 1;
+        entry->tag = btb_tag(new_address);
+        entry->last_used = ++btb.clock;
+    }
+    entry->target_address = new_target;
+    entry->conditional = conditional;
+}
+
+const char* direction_predictor_name() {
+    return direction_predictor->name;
+}
 
-    // Creates new entry
-    branch_table[t_index].branch_address = new_address;
-    branch_table[t_index].target_address = new_target;
-    branch_table[t_index].bht = (new_address+4 > new_target)*3;
-}
\ No newline at end of file
+uint8_t predict_direction(uint64_t branch_address) {
+    return direction_predictor->predict(branch_address, branch_history & history_mask);
+}
+
+uint8_t branch_type(uint32_t instruction) {
+    uint8_t opcode = (uint8_t) (instruction & 0x7F);
+    if (opcode == 0b1100011) {
+        return BRANCH_CONDITIONAL;
+    } else if (opcode == 0b1101111) {
+        return (uint8_t) ((instruction >> 7 & 0x1F) == 1 ? BRANCH_CALL : BRANCH_JUMP);
+    } else if (opcode == 0b1100111) {
+        return (uint8_t) (is_indirect_jump(instruction) ? BRANCH_INDIRECT : BRANCH_RETURN);
+    }
+    return BRANCH_NONE;
+}
+
+// trains the direction predictor with a resolved conditional branch and shifts its outcome into the history
+void update_direction(uint64_t branch_address, uint64_t history, uint8_t taken) {
+    direction_predictor->update(branch_address, history & history_mask, taken);
+    branch_history = branch_history << 1 | taken;
+}
@@ -4,9 +4,80 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "hart.h"
 
-uint64_t predict_address(uint64_t branch_address);
-uint64_t predict_address_BTFNT(uint64_t branch_address);
-void update_entry(uint64_t new_address, uint64_t new_target, uint8_t t_bht);
+// direction predictor types, selected with the bp_type option
+#define BP_BIMODAL 0
+#define BP_GSHARE 1
+#define BP_TOURNAMENT 2
+#define BP_TAGE 3
 
-#endif
\ No newline at end of file
+// control transfer types in a branch trace
+#define BRANCH_CONDITIONAL 0
+#define BRANCH_JUMP 1 // jal
+#define BRANCH_CALL 2 // jal with rd = ra
+#define BRANCH_RETURN 3 // jalr x0, ra
+#define BRANCH_INDIRECT 4 // any other jalr
+#define BRANCH_NONE 0xFF
+
+// partial tag kept per BTB entry
+#define BTB_TAG_BITS 12
+
+// indirect target predictor: partial tag per entry and path history bits taken from each target
+#define INDIRECT_TAG_BITS 8
+#define PATH_BITS_PER_TARGET 3
+
+// TAGE geometry
+#define TAGE_TABLES 4
+#define TAGE_TAG_BITS 9
+#define TAGE_USEFUL_RESET_PERIOD (1 << 18)
+
+// Conditional branch direction predictor; history is the global history as of the fetch of the branch
+struct direction_predictor {
+    const char* name;
+    uint8_t (*predict)(uint64_t pc, uint64_t history);
+    void (*update)(uint64_t pc, uint64_t history, uint8_t taken);
+};
+
+struct btb_entry {
+    uint8_t valid : 1;
+    uint8_t conditional : 1; // 1 if the direction predictor decides whether it is taken
+    uint16_t tag;
+    uint64_t target_address;
+    uint64_t last_used;
+};
+
+struct btb {
+    struct btb_entry* entries;
+    uint32_t num_sets;
+    uint32_t ways;
+    uint64_t clock;
+};
+
+// one resolved control transfer, written by the "branchtrace" command and read by bpreplay
+struct __attribute__((packed)) branch_trace_record {
+    uint64_t pc;
+    uint64_t target;
+    uint32_t instructions; // instructions executed since the previous record, this one included
+    uint8_t taken;
+    uint8_t type;
+};
+
+extern HART_LOCAL uint64_t branch_history; // global history, youngest outcome in bit 0
+extern HART_LOCAL uint64_t path_history; // low bits of recent indirect jump targets, youngest in the low bits
+
+void construct_branch_predictor(uint8_t type, uint8_t table_bits, uint8_t history_length);
+void construct_btb(uint32_t num_entries, uint32_t ways);
+void construct_ras(uint32_t num_entries);
+void ras_checkpoint(uint32_t* top, uint64_t* value);
+void ras_repair(uint32_t top, uint64_t value, uint64_t branch_address, uint32_t instruction);
+void construct_indirect_predictor(uint32_t num_entries, uint8_t path_length);
+void update_indirect(uint64_t branch_address, uint32_t instruction, uint64_t history, uint64_t target);
+uint64_t predict_address(uint64_t branch_address, uint32_t instruction);
+void update_entry(uint64_t new_address, uint64_t new_target, uint8_t conditional);
+void update_direction(uint64_t branch_address, uint64_t history, uint8_t taken);
+const char* direction_predictor_name();
+uint8_t predict_direction(uint64_t branch_address);
+uint8_t branch_type(uint32_t instruction);
+
+#endif
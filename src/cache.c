@@ -5,79 +5,420 @@
 # include <math.h>
 # include "riscv_sim_framework.h"
 #include "mem.h"
+# include <pthread.h>
+# include "hart.h"
+# include "plugin_host.h"
+# include "hostprofile.h"
 
 /*
  * Usage
- * read_access will return the index of the block with the data, OR 0xFFFF_FFFF_FFFF_FFFF if a stall is needed
- * write_access will return 0 if data written successfully, OR 1 if a stall is needed
+ * read_access will return 0 if data read successfully, 1 if a stall is needed (poll with is_followup next cycle),
+ *   OR 2 if the access must be retried from scratch next cycle
+ * write_access will return 0 if data written successfully, OR 1/2 if a stall is needed (same meaning as above)
+ * drain_write_buffer should be called once per cycle from the memory stage after the access, it writes back
+ *   one buffered dirty block whenever the memory port was left idle
+ * A tag_only cache still does every memory access a normal one would, but keeps no block data: hits are served
+ *   from memory directly and writes go straight to memory (writebacks then rewrite what memory already holds)
  * Note: address lengths are 64 bits, offset is 2/3 bits, [1/2:0]
+ *
+ * Coherence: with several harts, their D-caches join a MESI snooping protocol (join_coherence). A block is snooped
+ *   when it is installed, read (E, or S if another cache keeps it) or for ownership (M, other copies invalidated),
+ *   and a write hit on an S block rereads it for ownership first. Every access to a coherent cache holds
+ *   coherence_lock, so a snoop never finds another cache mid-access. Coherent caches are tag_only: memory always holds
+ *   the latest values, so the model decides which accesses miss and what traffic they cause, and a modified block a
+ *   snoop forces back to memory only has to drop its dirty bit.
+ * atomic_access does the A extension's read-modify-writes in one access. A load-reserved reserves its block, and the
+ *   reservation is lost when the block leaves the cache, by eviction or by another hart's write invalidating it, so a
+ *   store-conditional fails exactly when the cache could not have kept the block exclusive in between.
  */
 
 
 // Constructor for the struct -  this stuff should probably just be done in riscv_virt in the end, useful as reference
 // Can also just run this once on first(0th) cycle for I-cache, D-cache, and L2-cache
-void construct_cache(struct cache_table* cache, size_t num_blocks, uint8_t cache_type) {
+void construct_cache(struct cache_table* cache, size_t num_blocks, uint8_t cache_type, uint8_t tag_only) {
+    if (num_blocks == 0 || (num_blocks & (num_blocks - 1)) != 0) {
+        printf("cache size must be a power of 2, not %lu\n", num_blocks);
+        exit(1);
+    }
     cache->num_blocks = num_blocks;
     cache->index_length = (uint8_t) (log(num_blocks) / log(2));
     cache->cache_type = cache_type;
     cache->block_size = (uint8_t) (cache_type == CACHE_INSTRUCTION ? 4 : 3);
+    cache->tag_only = tag_only;
 #ifdef TWOWAY
-    cache->rows = scalloc(num_blocks * sizeof(union cache_row) * (cache->cache_type == CACHE_DATA ? 2 : 1));
+    size_t num_rows = num_blocks * (cache->cache_type == CACHE_DATA ? 2 : 1);
 #else
-    cache->rows = scalloc(num_blocks * sizeof(union cache_row));
+    size_t num_rows = num_blocks;
+#endif
+    cache->tags = scalloc(num_rows * sizeof(struct cache_tag));
+    cache->data = tag_only ? NULL : scalloc(num_rows << cache->block_size);
+    cache->write_buffer = NULL;
+    cache->write_buffer_count = 0;
+    cache->victims = NULL;
+    cache->victim_entries = 0;
+    cache->victim_clock = 0;
+    cache->fill_address = 0;
+    cache->fill_pending = 0;
+    cache->coherent = 0;
+    memset(&cache->coherence, 0, sizeof(struct coherence_stats));
+    cache->reservation = 0;
+    cache->reservation_valid = 0;
+    cache->accesses = 0;
+    cache->misses = 0;
+    if (cache_type == CACHE_DATA) {
+#ifdef WRITEBACK
+        cache->write_buffer = scalloc(WRITE_BUFFER_ENTRIES * sizeof(struct write_buffer_entry));
 #endif
+    }
 }
 
-union cache_row* evict_read(struct cache_table* cache, uint64_t address, uint64_t index, uint64_t tag, uint8_t is_followup) {
-    // Select index to be evicted (no choice if direct mapped)
+// Puts a fully associative victim cache of entries blocks behind a data cache, changing its miss timing
+void construct_victim_cache(struct cache_table* cache, uint32_t entries) {
+    cache->victims = scalloc(entries * sizeof(struct victim_entry));
+    cache->victim_entries = entries;
+}
+
+// Address of the first byte of the block held in row index (index may point into the second way)
+uint64_t row_address(struct cache_table* cache, uint64_t index) {
+    return ((uint64_t) cache->tags[index].tag << (cache->index_length + cache->block_size)) | ((index % cache->num_blocks) << cache->block_size);
+}
+
+uint32_t* row_data(struct cache_table* cache, uint64_t index) {
+    return cache->data + ((index << cache->block_size) >> 2);
+}
+
+// Picks the row of a set that a new block should go into
+uint64_t select_victim(struct cache_table* cache, uint64_t index) {
 #ifdef TWOWAY
-    if (cache->cache_type == CACHE_DATA && cache->rows[index].d.valid &&
-        (!cache->rows[index + cache->num_blocks].d.valid || (cache->rows[index].d.dirty && !cache->rows[index + cache->num_blocks].d.dirty))) {
+    if (cache->cache_type == CACHE_DATA && cache->tags[index].valid &&
+        (!cache->tags[index + cache->num_blocks].valid || (cache->tags[index].dirty && !cache->tags[index + cache->num_blocks].dirty))) {
         index += cache->num_blocks;
     }
 #endif
+    return index;
+}
 
-    uint8_t needs_stall = 0;
+// Write buffer: FIFO, oldest entry at [0]
 
-    // Eviction for writeback
-#ifdef WRITEBACK
-    if (cache->cache_type == CACHE_DATA && cache->rows[index].d.dirty) {
-        uint64_t old_address = (cache->rows[index].d.tag << (cache->index_length + cache->block_size) ) | (index << cache->block_size);
-        if (is_followup && !memory_status(old_address, NULL)) {
-            return NULL;
-        } else if (!is_followup && !memory_write(old_address, *(uint64_t*) (uint32_t*) cache->rows[index].d.data, 8)) {
-            needs_stall = 1; // old_address != address as then it would be a hit and evict_read is not called
-        } else {
-            cache->rows[index].d.dirty = 0;
+int write_buffer_find(struct cache_table* cache, uint64_t block_address) {
+    for (int i = cache->write_buffer_count - 1; i >= 0; i--) { // newest copy wins
+        if (cache->write_buffer[i].address == block_address) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void write_buffer_remove(struct cache_table* cache, int slot) {
+    memmove(&cache->write_buffer[slot], &cache->write_buffer[slot + 1], (cache->write_buffer_count - slot - 1) * sizeof(struct write_buffer_entry));
+    cache->write_buffer_count--;
+}
+
+void write_buffer_push(struct cache_table* cache, uint64_t block_address, uint64_t data) {
+    struct write_buffer_entry* entry = &cache->write_buffer[cache->write_buffer_count++];
+    entry->address = block_address;
+    entry->data = data;
+    entry->in_flight = 0;
+}
+
+void drain_write_buffer_unlocked(struct cache_table* cache) {
+    if (cache->write_buffer == NULL || cache->write_buffer_count == 0) {
+        return;
+    }
+    struct write_buffer_entry* entry = &cache->write_buffer[0];
+    if (entry->in_flight) {
+        if (!memory_status(entry->address, NULL)) {
+            return;
+        }
+    } else {
+        if (!memory_port_available()) { // the access of this stage took the port, try again next cycle
+            return;
+        }
+        if (cache->tag_only) { // memory already holds the latest value
+            memory_read_direct(entry->address, &entry->data, 8);
+        }
+        if (!memory_write(entry->address, entry->data, 8)) {
+            entry->in_flight = 1;
+            return;
+        }
+    }
+    write_buffer_remove(cache, 0);
+}
+
+// Victim cache
+
+int victim_find(struct cache_table* cache, uint64_t block_address) {
+    if (cache->victims == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < (int) cache->victim_entries; i++) {
+        if (cache->victims[i].valid && cache->victims[i].address == block_address) {
+            return i;
         }
     }
+    return -1;
+}
+
+// Slot the next victim will be written into - a free one, else the least recently used
+int victim_slot(struct cache_table* cache) {
+    int slot = 0;
+    for (int i = 0; i < (int) cache->victim_entries; i++) {
+        if (!cache->victims[i].valid) {
+            return i;
+        }
+        if (cache->victims[i].last_used < cache->victims[slot].last_used) {
+            slot = i;
+        }
+    }
+    return slot;
+}
+
+// Coherence
+
+struct cache_table* coherent_caches[MAX_HARTS];
+uint32_t coherent_cache_count = 0;
+pthread_mutex_t coherence_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void join_coherence(struct cache_table* cache) {
+    pthread_mutex_lock(&coherence_lock);
+    cache->coherent = 1;
+    coherent_caches[coherent_cache_count++] = cache;
+    pthread_mutex_unlock(&coherence_lock);
+}
+
+// a fill of block_address is starting
+void count_miss(struct cache_table* cache, uint64_t block_address) {
+    cache->misses++;
+    if (plugin_hooks & PLUGIN_HOOK_CACHE_MISS) {
+        plugin_cache_miss(cache, block_address);
+    }
+}
+
+// Tells the other caches that block_address is being read (exclusive = 0) or read for ownership (1).
+// Returns 1 if one of them keeps a copy, in which case the block is installed shared
+uint8_t snoop(struct cache_table* cache, uint64_t block_address, uint8_t exclusive) {
+    uint8_t shared = 0;
+    for (uint32_t i = 0; i < coherent_cache_count; i++) {
+        struct cache_table* other = coherent_caches[i];
+        if (other == cache) {
+            continue;
+        }
+        uint64_t index = (block_address >> other->block_size) % other->num_blocks;
+        uint64_t tag = block_address >> (other->block_size + other->index_length);
+#ifdef TWOWAY
+        uint64_t end = index + 2 * other->num_blocks;
+#else
+        uint64_t end = index + 1;
 #endif
+        for (uint64_t row = index; row < end; row += other->num_blocks) {
+            struct cache_tag* line = &other->tags[row];
+            if (!line->valid || line->tag != tag) {
+                continue;
+            }
+            other->coherence.writebacks += line->dirty;
+            line->dirty = 0;
+            if (exclusive) {
+                line->valid = 0;
+                other->coherence.invalidations++;
+            } else {
+                line->shared = 1;
+                shared = 1;
+            }
+        }
+        // a write kills the reservation even while the block is away being reread for ownership
+        if (exclusive && other->reservation == block_address) {
+            other->reservation_valid = 0;
+        }
+        // a victim cache entry has no shared state, so any snoop drops it
+        int victim = victim_find(other, block_address);
+        if (victim >= 0) {
+            other->coherence.writebacks += other->victims[victim].dirty;
+            other->victims[victim].valid = 0;
+            other->coherence.invalidations++;
+        }
+    }
+    return shared;
+}
+
+// A write to a block held shared gives it up and rereads it for ownership, like a miss
+void upgrade_shared(struct cache_table* cache, uint64_t index, uint64_t tag) {
+#ifdef TWOWAY
+    uint64_t end = index + 2 * cache->num_blocks;
+#else
+    uint64_t end = index + 1;
+#endif
+    for (uint64_t row = index; row < end; row += cache->num_blocks) {
+        if (cache->tags[row].valid && cache->tags[row].tag == tag && cache->tags[row].shared) {
+            cache->tags[row].valid = 0;
+            cache->tags[row].shared = 0;
+            cache->coherence.upgrades++;
+        }
+    }
+}
+
+// Returns 1 if evicting row index would need a free write buffer entry
+uint8_t eviction_needs_write_buffer(struct cache_table* cache, uint64_t index, int freed_victim) {
+    if (!cache->tags[index].valid) {
+        return 0;
+    }
+    if (cache->victims != NULL) {
+        if (freed_victim >= 0) {
+            return 0;
+        }
+        struct victim_entry* victim = &cache->victims[victim_slot(cache)];
+        return (uint8_t) (victim->valid && victim->dirty);
+    }
+    return cache->tags[index].dirty;
+}
+
+// Moves row index out of the data cache, caller has checked eviction_needs_write_buffer
+void evict_row(struct cache_table* cache, uint64_t index) {
+    struct cache_tag* row = &cache->tags[index];
+    if (!row->valid) {
+        return;
+    }
+    uint64_t old_address = row_address(cache, index);
+    if (cache->reservation == old_address) {
+        cache->reservation_valid = 0;
+    }
+    if (cache->victims != NULL) {
+        struct victim_entry* victim = &cache->victims[victim_slot(cache)];
+        if (victim->valid && victim->dirty) {
+            uint64_t data;
+            memcpy(&data, victim->data, sizeof(data));
+            write_buffer_push(cache, victim->address, data);
+        }
+        victim->address = old_address;
+        if (!cache->tag_only) {
+            memcpy(victim->data, row_data(cache, index), sizeof(victim->data));
+        }
+        victim->dirty = row->dirty;
+        victim->valid = 1;
+        victim->last_used = cache->victim_clock++;
+    } else if (row->dirty) {
+        write_buffer_push(cache, old_address, cache->tag_only ? 0 : *(uint64_t*) row_data(cache, index));
+    }
+    row->valid = 0;
+    row->dirty = 0;
+}
+
+// Makes room in row index for the block at block_address, filling it from the victim cache or write buffer when
+// either one holds the block. Returns 0 and sets *found if the block was refilled without memory, 2 if a retry is needed
+uint8_t evict_data_row(struct cache_table* cache, uint64_t index, uint64_t block_address, uint8_t* found) {
+    int buffered = write_buffer_find(cache, block_address);
+    if (buffered >= 0 && cache->write_buffer[buffered].in_flight) { // let the write finish before reading it back
+        return 2;
+    }
+    int victim = victim_find(cache, block_address);
+    if (cache->write_buffer != NULL && cache->write_buffer_count >= WRITE_BUFFER_ENTRIES && eviction_needs_write_buffer(cache, index, victim)) {
+        drain_write_buffer_unlocked(cache);
+        return 2;
+    }
+
+    struct victim_entry refill = {0};
+    if (victim >= 0) {
+        refill = cache->victims[victim];
+        cache->victims[victim].valid = 0;
+    } else if (buffered >= 0) {
+        refill.address = block_address;
+        memcpy(refill.data, &cache->write_buffer[buffered].data, sizeof(refill.data));
+        refill.dirty = 1;
+        refill.valid = 1;
+        write_buffer_remove(cache, buffered);
+    }
+    evict_row(cache, index);
+
+    *found = refill.valid;
+    if (refill.valid) {
+        if (!cache->tag_only) {
+            memcpy(row_data(cache, index), refill.data, sizeof(refill.data));
+        }
+        cache->tags[index].dirty = refill.dirty;
+    }
+    return 0;
+}
+
+uint8_t evict_read(struct cache_table* cache, uint64_t address, uint64_t index, uint64_t tag, uint8_t is_followup, uint8_t memory_read_available, uint8_t exclusive, uint64_t* ret_index) {
+    // Select index to be evicted (no choice if direct mapped)
+    index = select_victim(cache, index);
+    *ret_index = index;
+    uint64_t block_address = address >> cache->block_size << cache->block_size;
+    uint32_t discard[4];
+    uint32_t* fill = cache->tag_only ? discard : row_data(cache, index);
 
     // Input new values
     if (cache->cache_type == CACHE_DATA) {
-        if (is_followup && !memory_status(address, cache->rows[index].d.data)) {
-            return NULL;
-        } else if (!is_followup && (!memory_read(address, cache->rows[index].d.data, 8) || needs_stall)) {
-            return NULL;
+        if (is_followup) {
+            if (!memory_status(block_address, fill)) {
+                return 1;
+            }
+        } else {
+            uint8_t found = 0;
+            int missing = victim_find(cache, block_address) < 0 && write_buffer_find(cache, block_address) < 0;
+            if (missing && !memory_read_available) { // TLB took up our memory bandwidth, stall
+                return 2;
+            }
+            uint8_t status = evict_data_row(cache, index, block_address, &found);
+            if (status) {
+                return status;
+            }
+            count_miss(cache, block_address);
+            if (!found && !memory_read(block_address, fill, 8)) {
+                return 1;
+            }
+            if (!found) {
+                cache->tags[index].dirty = 0;
+            }
         }
-        cache->rows[index].d.tag = tag;
-        cache->rows[index].d.valid = 1;
-#ifdef WRITEBACK
-        cache->rows[index].d.dirty = 0;
-#endif
     } else {
-        if (is_followup && !memory_status(address, cache->rows[index].i.data)) {
-            return NULL;
-        } else if (!is_followup && (!memory_read(address, cache->rows[index].i.data, 16) || needs_stall)) {
-            return NULL;
+        // A fill keeps going when fetch is redirected during the miss - wait for it and install it before
+        // starting the next one, rather than leaving it behind in a memory slot
+        if (cache->fill_pending) {
+            uint64_t fill_index = (cache->fill_address >> cache->block_size) % cache->num_blocks;
+            if (!memory_status(cache->fill_address, cache->tag_only ? discard : row_data(cache, fill_index))) {
+                return 1;
+            }
+            cache->fill_pending = 0;
+            cache->tags[fill_index].tag = cache->fill_address >> (cache->block_size + cache->index_length);
+            cache->tags[fill_index].valid = 1;
+            if (cache->fill_address == block_address) {
+                return 0;
+            }
         }
-        cache->rows[index].i.tag = tag;
-        cache->rows[index].i.valid = 1;
+        if (!memory_read_available) { // TLB took up our memory bandwidth, stall
+            return 2;
+        }
+        count_miss(cache, block_address);
+        if (!memory_read(block_address, fill, 16)) {
+            cache->fill_address = block_address;
+            cache->fill_pending = 1;
+            return 1;
+        }
+    }
+    cache->tags[index].tag = tag;
+    cache->tags[index].valid = 1;
+    if (cache->coherent) { // a block refilled dirty from the victim cache or write buffer is modified
+        cache->tags[index].shared = snoop(cache, block_address, (uint8_t) (exclusive || cache->tags[index].dirty));
+    }
+    return 0;
+}
+
+// Returns the aligned 8 bytes at word subindex of row index (the upper half is only meaningful for size 8 reads)
+uint64_t row_read(struct cache_table* cache, uint64_t index, uint64_t address, uint64_t subindex, uint64_t size) {
+    uint64_t value = 0;
+    if (cache->tag_only) {
+        memory_read_direct(address, &value, size);
+        return value;
+    }
+    uint32_t* data = row_data(cache, index);
+    value = data[subindex];
+    if (size == 8) {
+        value = value | (uint64_t) data[subindex + 1] << 32;
     }
-    return &cache->rows[index];
+    return value;
 }
 
-uint8_t read_access(struct cache_table* cache, uint64_t address, uint64_t size, uint64_t* value, uint8_t is_followup, uint8_t memory_read_available) {
+uint8_t read_access_unlocked(struct cache_table* cache, uint64_t address, uint64_t size, uint64_t* value, uint8_t is_followup, uint8_t memory_read_available) {
     // extracts index
     uint64_t index = (address << ((64 - cache->block_size) - cache->index_length)) >> (64 - cache->index_length);
     // extracts tag
@@ -88,54 +429,29 @@ uint8_t read_access(struct cache_table* cache, uint64_t address, uint64_t size,
         exit(1);
     }
     subindex >>= 2;
-    uint64_t cache_hit = 0;
     uint8_t was_hit = 0;
     if (cache->cache_type == CACHE_INSTRUCTION) {
-        if (cache->rows[index].i.valid && cache->rows[index].i.tag == tag && (size != 8 || subindex != 3)) {
+        if (cache->tags[index].valid && cache->tags[index].tag == tag && (size != 8 || subindex != 3)) {
             was_hit = 1;
-            cache_hit = cache->rows[index].i.data[subindex];
-            if (size == 8) {
-                cache_hit = cache_hit | (uint64_t) cache->rows[index].i.data[subindex + 1] << 32;
-            }
         }
     } else {
-        if (cache->rows[index].d.valid && cache->rows[index].d.tag == tag) {
+        if (cache->tags[index].valid && cache->tags[index].tag == tag) {
             was_hit = 1;
-            cache_hit = cache->rows[index].d.data[subindex];
-            if (size == 8) {
-                cache_hit = cache_hit | (uint64_t) cache->rows[index].d.data[subindex + 1] << 32;
-            }
         }
 #ifdef TWOWAY
-        else if (cache->rows[index + cache->num_blocks].d.valid && cache->rows[index + cache->num_blocks].d.tag == tag) {
+        else if (cache->tags[index + cache->num_blocks].valid && cache->tags[index + cache->num_blocks].tag == tag) {
             was_hit = 1;
-            cache_hit = cache->rows[index + cache->num_blocks].d.data[subindex];
-            if (size == 8) {
-                cache_hit = cache_hit | (uint64_t) cache->rows[index + cache->num_blocks].d.data[subindex + 1] << 32;
-            }
+            index += cache->num_blocks;
         }
 #endif
     }
     if (!was_hit) {
-        if (!memory_read_available) { // TLB took up our memory bandwidth, stall
-            return 2;
-        }
-        union cache_row* row = evict_read(cache, address, index, tag, is_followup);
-        if (row == NULL) { // stall
-            return 1;
-        }
-        if (cache->cache_type == CACHE_INSTRUCTION) {
-            cache_hit = row->i.data[subindex];
-            if (size == 8) {
-                cache_hit = cache_hit | (uint64_t) row->i.data[subindex + 1] << 32;
-            }
-        } else {
-            cache_hit = row->d.data[subindex];
-            if (size == 8) {
-                cache_hit = cache_hit | (uint64_t) row->d.data[subindex + 1] << 32;
-            }
+        uint8_t status = evict_read(cache, address, index, tag, is_followup, memory_read_available, 0, &index);
+        if (status) { // stall
+            return status;
         }
     }
+    uint64_t cache_hit = row_read(cache, index, address, subindex, size);
     if (size == 1) {
         *((uint8_t*) value) = (uint8_t) cache_hit;
     } else if (size == 2) {
@@ -151,6 +467,15 @@ uint8_t read_access(struct cache_table* cache, uint64_t address, uint64_t size,
     return 0;
 }
 
+// Writes size bytes at byte subindex of row index (or straight to memory for a tag_only cache)
+void row_write(struct cache_table* cache, uint64_t index, uint64_t address, uint64_t subindex, uint64_t data, uint8_t size) {
+    if (cache->tag_only) {
+        memory_write_direct(address, &data, size);
+    } else {
+        memcpy((uint8_t*) row_data(cache, index) + subindex, &data, size);
+    }
+}
+
 uint8_t evict_write(struct cache_table* cache, uint64_t address, uint64_t index, uint64_t tag, uint64_t data, uint64_t subindex, uint8_t size, uint8_t is_followup, uint8_t memory_read_available) {
     if (cache->cache_type != CACHE_DATA) { // we never write to the instruction cache
         return 2;
@@ -161,56 +486,39 @@ uint8_t evict_write(struct cache_table* cache, uint64_t address, uint64_t index,
     }
 #endif
 
-#ifdef TWOWAY
-    if (cache->rows[index].d.valid &&
-            (!cache->rows[index + cache->num_blocks].d.valid || (cache->rows[index].d.dirty && !cache->rows[index + cache->num_blocks].d.dirty))) {
-        index += cache->num_blocks;
-    }
-#endif
-
-    union cache_row *row = NULL;
     if (size != 8) {
-        if (!memory_read_available) { // TLB took up our memory bandwidth, stall
-            return 2;
+        uint8_t status = evict_read(cache, address, index, tag, is_followup, memory_read_available, 1, &index);
+        if (status) { // stall for memory read
+            return status;
         }
-        row = evict_read(cache, address, index, tag, is_followup);
-        if (row == NULL) { // stall for memory read
-            return 1;
+    } else { // size == 8, the whole block is overwritten so nothing has to be read
+        index = select_victim(cache, index);
+        uint64_t block_address = address >> cache->block_size << cache->block_size;
+        uint8_t found = 0;
+        uint8_t status = evict_data_row(cache, index, block_address, &found);
+        if (status) {
+            return status;
         }
-    } else { // size == 8
-        row = &cache->rows[index];
-
-#ifdef WRITEBACK
-        // Eviction for writeback (handled by evict_read in other cases)
-        if (row->d.dirty) {
-            if (!memory_read_available) { // TLB took up our memory bandwidth, stall
-                return 2;
-            }
-            uint64_t old_address = (row->d.tag << (cache->index_length + cache->block_size) ) | (index << cache->block_size);
-            if (is_followup && !memory_status(old_address, NULL)) {
-                return 1;
-            } else if (!is_followup && !memory_write(old_address, *(uint64_t*) (uint32_t*) row->d.data, 8)) {
-                return 1;
-            } else {
-                row->d.dirty = 0;
-            }
+        count_miss(cache, block_address);
+        if (cache->coherent) {
+            snoop(cache, block_address, 1);
+            cache->tags[index].shared = 0;
         }
-#endif
     }
 
     // Input new values
-    memcpy((uint8_t*) row->d.data + subindex, &data, size);
-    row->d.tag = tag;
-    row->d.valid = 1;
+    row_write(cache, index, address, subindex, data, size);
+    cache->tags[index].tag = tag;
+    cache->tags[index].valid = 1;
 #ifdef WRITEBACK
-    row->d.dirty = 1;
+    cache->tags[index].dirty = 1;
     return 0;
 #else
     return (uint8_t) !memory_write(address, data, size);
 #endif
 }
 
-uint8_t write_access(struct cache_table* cache, uint64_t address, uint64_t data, uint8_t size, uint8_t is_followup, uint8_t memory_read_available) {
+uint8_t write_access_unlocked(struct cache_table* cache, uint64_t address, uint64_t data, uint8_t size, uint8_t is_followup, uint8_t memory_read_available) {
     if (cache->cache_type != CACHE_DATA) { // we never write to the instruction cache
         return 1;
     }
@@ -219,18 +527,170 @@ uint8_t write_access(struct cache_table* cache, uint64_t address, uint64_t data,
     // extracts tag
     uint64_t tag = address >> (cache->block_size + cache->index_length);
     uint64_t subindex = address << (64 - cache->block_size) >> (64 - cache->block_size);
+    if (cache->coherent) {
+        upgrade_shared(cache, index, tag);
+    }
 
     // Checks cache
-    if (cache->rows[index].d.valid && cache->rows[index].d.tag == tag) {
-        memcpy((uint8_t*) cache->rows[index].d.data + subindex, &data, size);
+    if (cache->tags[index].valid && cache->tags[index].tag == tag) {
+        row_write(cache, index, address, subindex, data, size);
+#ifdef WRITEBACK
+        cache->tags[index].dirty = 1;
+#endif
         return 0;
     }
 #ifdef TWOWAY
-    else if (cache->rows[index + cache->num_blocks].d.valid && cache->rows[index + cache->num_blocks].d.tag == tag) {
-        memcpy((uint8_t*) cache->rows[index].d.data + subindex, &data, size);
+    else if (cache->tags[index + cache->num_blocks].valid && cache->tags[index + cache->num_blocks].tag == tag) {
+        row_write(cache, index + cache->num_blocks, address, subindex, data, size);
+#ifdef WRITEBACK
+        cache->tags[index + cache->num_blocks].dirty = 1;
+#endif
         return 0;
     }
 #endif
 
     return evict_write(cache, address, index, tag, data, subindex, size, is_followup, memory_read_available);
-}
\ No newline at end of file
+}
+
+uint8_t reservation_held(struct cache_table* cache, uint64_t block_address) {
+    return cache->reservation_valid && cache->reservation == block_address;
+}
+
+uint8_t atomic_access_unlocked(struct cache_table* cache, uint64_t address, const struct atomic_update* update, uint64_t* value, uint8_t is_followup, uint8_t memory_read_available) {
+    if (cache->cache_type != CACHE_DATA) {
+        return 1;
+    }
+    // extracts index
+    uint64_t index = (address << ((64 - cache->block_size) - cache->index_length)) >> (64 - cache->index_length);
+    // extracts tag
+    uint64_t tag = address >> (cache->block_size + cache->index_length);
+    uint64_t subindex = address << (64 - cache->block_size) >> (64 - cache->block_size);
+    uint64_t block_address = address >> cache->block_size << cache->block_size;
+    if (update->conditional && !is_followup && !reservation_held(cache, block_address)) { // fails without going to the cache
+        cache->reservation_valid = 0;
+        *value = 1;
+        return 0;
+    }
+    uint8_t exclusive = update->conditional || update->modify != NULL;
+    if (exclusive && cache->coherent) {
+        upgrade_shared(cache, index, tag);
+    }
+    uint8_t was_hit = cache->tags[index].valid && cache->tags[index].tag == tag;
+#ifdef TWOWAY
+    if (!was_hit && cache->tags[index + cache->num_blocks].valid && cache->tags[index + cache->num_blocks].tag == tag) {
+        was_hit = 1;
+        index += cache->num_blocks;
+    }
+#endif
+    if (!was_hit) {
+        uint8_t status = evict_read(cache, address, index, tag, is_followup, memory_read_available, exclusive, &index);
+        if (status) {
+            return status;
+        }
+    }
+    uint64_t old_value = row_read(cache, index, address, subindex >> 2, update->size);
+    if (update->size == 4) {
+        old_value = (uint32_t) old_value;
+    }
+    uint64_t new_value;
+    if (update->conditional) {
+        if (!reservation_held(cache, block_address)) { // lost to another hart while the block was fetched, the fill is still kept
+            *value = 1;
+            return 0;
+        }
+        cache->reservation_valid = 0;
+        new_value = update->operand;
+        *value = 0;
+    } else if (update->modify == NULL) {
+        cache->reservation = block_address;
+        cache->reservation_valid = 1;
+        *value = old_value;
+        return 0;
+    } else {
+        new_value = update->modify(old_value, update);
+        *value = old_value;
+    }
+    row_write(cache, index, address, subindex, new_value, update->size);
+#ifdef WRITEBACK
+    cache->tags[index].dirty = 1;
+#endif
+    return 0;
+}
+
+// The entry points take coherence_lock around the access when the cache is coherent; reads and writes are timed by the
+// host profile with the wait for the lock included
+
+static uint8_t locked_read_access(struct cache_table* cache, uint64_t address, uint64_t size, uint64_t* value, uint8_t is_followup, uint8_t memory_read_available) {
+    cache->accesses += !is_followup;
+    if (!cache->coherent) {
+        return read_access_unlocked(cache, address, size, value, is_followup, memory_read_available);
+    }
+    pthread_mutex_lock(&coherence_lock);
+    uint8_t status = read_access_unlocked(cache, address, size, value, is_followup, memory_read_available);
+    pthread_mutex_unlock(&coherence_lock);
+    return status;
+}
+
+uint8_t read_access(struct cache_table* cache, uint64_t address, uint64_t size, uint64_t* value, uint8_t is_followup, uint8_t memory_read_available) {
+    uint8_t status;
+    HOSTPROFILE_TIME(HOSTPROFILE_READ_ACCESS, status = locked_read_access(cache, address, size, value, is_followup, memory_read_available));
+    return status;
+}
+
+// Reads the aligned word at address if its block is already in the cache, without counting an access or starting a
+// fill; returns 1 if the block is not there. Fetch uses it for the second issue slot, which comes out of the block the
+// first slot's access just read.
+uint8_t read_resident_word(struct cache_table* cache, uint64_t address, uint32_t* value) {
+    uint64_t index = (address << ((64 - cache->block_size) - cache->index_length)) >> (64 - cache->index_length);
+    uint64_t tag = address >> (cache->block_size + cache->index_length);
+    uint64_t subindex = address << (64 - cache->block_size) >> (64 - cache->block_size + 2);
+    if (cache->coherent) {
+        pthread_mutex_lock(&coherence_lock);
+    }
+    uint8_t resident = cache->tags[index].valid && cache->tags[index].tag == tag;
+    if (resident) {
+        *value = (uint32_t) row_read(cache, index, address, subindex, 4);
+    }
+    if (cache->coherent) {
+        pthread_mutex_unlock(&coherence_lock);
+    }
+    return (uint8_t) !resident;
+}
+
+static uint8_t locked_write_access(struct cache_table* cache, uint64_t address, uint64_t data, uint8_t size, uint8_t is_followup, uint8_t memory_read_available) {
+    cache->accesses += !is_followup;
+    if (!cache->coherent) {
+        return write_access_unlocked(cache, address, data, size, is_followup, memory_read_available);
+    }
+    pthread_mutex_lock(&coherence_lock);
+    uint8_t status = write_access_unlocked(cache, address, data, size, is_followup, memory_read_available);
+    pthread_mutex_unlock(&coherence_lock);
+    return status;
+}
+
+uint8_t write_access(struct cache_table* cache, uint64_t address, uint64_t data, uint8_t size, uint8_t is_followup, uint8_t memory_read_available) {
+    uint8_t status;
+    HOSTPROFILE_TIME(HOSTPROFILE_WRITE_ACCESS, status = locked_write_access(cache, address, data, size, is_followup, memory_read_available));
+    return status;
+}
+
+void drain_write_buffer(struct cache_table* cache) {
+    if (!cache->coherent) {
+        drain_write_buffer_unlocked(cache);
+        return;
+    }
+    pthread_mutex_lock(&coherence_lock);
+    drain_write_buffer_unlocked(cache);
+    pthread_mutex_unlock(&coherence_lock);
+}
+
+uint8_t atomic_access(struct cache_table* cache, uint64_t address, const struct atomic_update* update, uint64_t* value, uint8_t is_followup, uint8_t memory_read_available) {
+    cache->accesses += !is_followup;
+    if (!cache->coherent) {
+        return atomic_access_unlocked(cache, address, update, value, is_followup, memory_read_available);
+    }
+    pthread_mutex_lock(&coherence_lock);
+    uint8_t status = atomic_access_unlocked(cache, address, update, value, is_followup, memory_read_available);
+    pthread_mutex_unlock(&coherence_lock);
+    return status;
+}
@@ -12,24 +12,47 @@
 #define WRITEBACK
 #define TWOWAY
 
-struct cache_row_i {
-    uint64_t tag:51;
-    uint32_t data[4];
+#define WRITE_BUFFER_ENTRIES 4
+
+// tags are kept apart from the block data so the data can be left out entirely (tag_only)
+// In a coherent D-cache they also hold the MESI state: I = !valid, S = shared, E = !shared && !dirty, M = dirty
+struct cache_tag {
+    uint64_t tag:61;
+    uint8_t shared:1; // another hart's D-cache may hold the block too
+    uint8_t dirty:1; // only ever set with WRITEBACK
     uint8_t valid:1;
 };
 
-struct cache_row_d {
-    uint64_t tag:50;
+// dirty blocks waiting for an idle memory cycle to be written back
+struct write_buffer_entry {
+    uint64_t address;
+    uint64_t data;
+    uint8_t in_flight:1; // memory_write issued, waiting on memory_status
+};
+
+// fully associative, holds blocks recently evicted from the data cache
+struct victim_entry {
+    uint64_t address;
     uint32_t data[2];
-#ifdef WRITEBACK
+    uint64_t last_used;
     uint8_t dirty:1;
-#endif
     uint8_t valid:1;
 };
 
-union cache_row {
-    struct cache_row_i i;
-    struct cache_row_d d;
+struct coherence_stats {
+    uint64_t invalidations; // blocks dropped because another hart wrote them
+    uint64_t writebacks; // modified blocks another hart's access forced back to memory
+    uint64_t upgrades; // writes to a shared block, which reread it for ownership
+};
+
+// An A-extension access done by atomic_access: a load-reserved if modify is NULL and conditional is 0, a
+// store-conditional of operand if conditional is 1, else an AMO writing modify(old value)
+struct atomic_update {
+    uint64_t (*modify)(uint64_t old_value, const struct atomic_update* update);
+    uint64_t operand;
+    uint8_t operation; // funct5 of the instruction, for modify
+    uint8_t size; // 4 or 8
+    uint8_t conditional;
 };
 
 struct cache_table {
@@ -37,11 +60,31 @@ struct cache_table {
     uint8_t index_length;
     uint8_t cache_type;
     uint8_t block_size;
-    union cache_row* rows;
+    uint8_t tag_only; // timing only, values are read from and written to memory directly
+    struct cache_tag* tags;
+    uint32_t* data; // (1 << block_size) bytes per row, NULL if tag_only
+    struct write_buffer_entry* write_buffer;
+    uint8_t write_buffer_count;
+    struct victim_entry* victims; // NULL without a victim cache
+    uint32_t victim_entries;
+    uint64_t victim_clock;
+    uint64_t fill_address; // I-cache block still being read from memory
+    uint8_t fill_pending;
+    uint8_t coherent; // snooped by and snoops the other harts' D-caches
+    struct coherence_stats coherence;
+    uint64_t reservation; // block of the last load-reserved, held while the block stays in the cache
+    uint8_t reservation_valid;
+    uint64_t accesses; // lookups, not counting the retries of one waiting for its fill
+    uint64_t misses; // blocks brought in, counted when the fill starts
 };
 
-void construct_cache(struct cache_table* cache, size_t num_blocks, uint8_t cache_type);
+void construct_cache(struct cache_table* cache, size_t num_blocks, uint8_t cache_type, uint8_t tag_only);
+void construct_victim_cache(struct cache_table* cache, uint32_t entries);
 uint8_t read_access(struct cache_table* cache, uint64_t address, uint64_t size, uint64_t* value, uint8_t is_followup, uint8_t memory_read_available);
+uint8_t read_resident_word(struct cache_table* cache, uint64_t address, uint32_t* value);
 uint8_t write_access(struct cache_table* cache, uint64_t address, uint64_t data, uint8_t size, uint8_t is_followup, uint8_t memory_read_available);
+void drain_write_buffer(struct cache_table* cache);
+uint8_t atomic_access(struct cache_table* cache, uint64_t address, const struct atomic_update* update, uint64_t* value, uint8_t is_followup, uint8_t memory_read_available);
+void join_coherence(struct cache_table* cache);
 
 # endif
\ No newline at end of file
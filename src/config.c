@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "config.h"
+
+struct sim_config sim_config = {
+    .core_type = 0,
+    .issue_width = 1,
+    .icache_blocks = 512,
+    .dcache_blocks = 2048,
+    .victim_cache_entries = 0,
+    .cache_tag_only = 0,
+    .itlb_entries = 8,
+    .dtlb_entries = 8,
+    .tlb_ways = 1,
+    .walk_cache_entries = 4,
+    .l2tlb_entries = 0,
+    .l2tlb_ways = 4,
+    .l2tlb_latency = 2,
+    .bp_type = 0,
+    .bp_table_bits = 10,
+    .bp_history_length = 12,
+    .btb_entries = 32,
+    .btb_ways = 4,
+    .ras_entries = 8,
+    .itp_entries = 64,
+    .itp_path_length = 4,
+    .rob_entries = 32,
+    .iq_entries = 16,
+    .lsq_entries = 8,
+    .harts = 1,
+    .quantum = 100,
+};
+
+struct config_option {
+    const char* name;
+    uint64_t* value;
+    const char* description;
+};
+
+struct config_option config_options[] = {
+    {"core_type", &sim_config.core_type, "timing model, 0 five stage in-order pipeline, 1 out-of-order back end"},
+    {"issue_width", &sim_config.issue_width, "instructions issued per cycle, 1 or 2 (dual issue of ALU pairs)"},
+    {"icache_blocks", &sim_config.icache_blocks, "number of 16 byte blocks in the I-cache (power of 2)"},
+    {"dcache_blocks", &sim_config.dcache_blocks, "number of 8 byte blocks per way in the D-cache (power of 2)"},
+    {"victim_cache_entries", &sim_config.victim_cache_entries, "blocks in the fully associative D-cache victim cache, 0 for none"},
+    {"cache_tag_only", &sim_config.cache_tag_only, "1 to keep only tags in the caches and read values from memory"},
+    {"itlb_entries", &sim_config.itlb_entries, "number of I-TLB entries"},
+    {"dtlb_entries", &sim_config.dtlb_entries, "number of D-TLB entries"},
+    {"tlb_ways", &sim_config.tlb_ways, "TLB associativity, entries / ways must be a power of 2"},
+    {"walk_cache_entries", &sim_config.walk_cache_entries, "first-level PTEs kept per TLB in the page-walk cache"},
+    {"l2tlb_entries", &sim_config.l2tlb_entries, "entries in the shared second-level TLB, 0 for none"},
+    {"l2tlb_ways", &sim_config.l2tlb_ways, "second-level TLB associativity"},
+    {"l2tlb_latency", &sim_config.l2tlb_latency, "cycles to look up the second-level TLB"},
+    {"bp_type", &sim_config.bp_type, "branch direction predictor, 0 bimodal, 1 gshare, 2 tournament, 3 TAGE"},
+    {"bp_table_bits", &sim_config.bp_table_bits, "log2 of the entries in each branch predictor table"},
+    {"bp_history_length", &sim_config.bp_history_length, "global branch history bits, at most 64"},
+    {"btb_entries", &sim_config.btb_entries, "number of branch target buffer entries"},
+    {"btb_ways", &sim_config.btb_ways, "BTB associativity, entries / ways must be a power of 2"},
+    {"ras_entries", &sim_config.ras_entries, "return address stack entries, 0 for none"},
+    {"itp_entries", &sim_config.itp_entries, "indirect jump target predictor entries (power of 2), 0 for none"},
+    {"itp_path_length", &sim_config.itp_path_length, "indirect jump targets hashed into the target predictor index"},
+    {"rob_entries", &sim_config.rob_entries, "out-of-order core: reorder buffer entries"},
+    {"iq_entries", &sim_config.iq_entries, "out-of-order core: issue queue entries"},
+    {"lsq_entries", &sim_config.lsq_entries, "out-of-order core: entries in each of the load queue and the store queue"},
+    {"harts", &sim_config.harts, "number of harts, each on its own host thread with coherent private D-caches"},
+    {"quantum", &sim_config.quantum, "cycles each hart runs between synchronizations with the others"},
+};
+
+#define NUM_CONFIG_OPTIONS (sizeof(config_options) / sizeof(struct config_option))
+
+// set once the pipeline has built its structures from the config
+uint8_t config_locked = 0;
+
+void config_lock() {
+    config_locked = 1;
+}
+
+uint8_t config_set(const char* name, uint64_t value) {
+    if (config_locked) {
+        fprintf(stderr, "config: options must be set before the first run\n");
+        return 0;
+    }
+    for (size_t i = 0; i < NUM_CONFIG_OPTIONS; i++) {
+        if (!strcasecmp(config_options[i].name, name)) {
+            *config_options[i].value = value;
+            return 1;
+        }
+    }
+    fprintf(stderr, "config: unknown option %s\n", name);
+    return 0;
+}
+
+uint64_t config_get(const char* name) {
+    for (size_t i = 0; i < NUM_CONFIG_OPTIONS; i++) {
+        if (!strcasecmp(config_options[i].name, name)) {
+            return *config_options[i].value;
+        }
+    }
+    fprintf(stderr, "config: unknown option %s\n", name);
+    return 0;
+}
+
+void config_print(FILE* out) {
+    for (size_t i = 0; i < NUM_CONFIG_OPTIONS; i++) {
+        fprintf(out, "%-20s %-10llu %s\n", config_options[i].name, (unsigned long long) *config_options[i].value, config_options[i].description);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef RISCVSIM_CONFIG_H
+#define RISCVSIM_CONFIG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Runtime options, changed with the "config <name> <value>" command before the first run
+struct sim_config {
+    uint64_t core_type;
+    uint64_t issue_width;
+    uint64_t icache_blocks;
+    uint64_t dcache_blocks;
+    uint64_t victim_cache_entries;
+    uint64_t cache_tag_only;
+    uint64_t itlb_entries;
+    uint64_t dtlb_entries;
+    uint64_t tlb_ways;
+    uint64_t walk_cache_entries;
+    uint64_t l2tlb_entries;
+    uint64_t l2tlb_ways;
+    uint64_t l2tlb_latency;
+    uint64_t bp_type;
+    uint64_t bp_table_bits;
+    uint64_t bp_history_length;
+    uint64_t btb_entries;
+    uint64_t btb_ways;
+    uint64_t ras_entries;
+    uint64_t itp_entries;
+    uint64_t itp_path_length;
+    uint64_t rob_entries;
+    uint64_t iq_entries;
+    uint64_t lsq_entries;
+    uint64_t harts;
+    uint64_t quantum;
+};
+
+extern struct sim_config sim_config;
+
+uint8_t config_set(const char* name, uint64_t value);
+uint64_t config_get(const char* name);
+void config_print(FILE* out);
+void config_lock();
+
+#endif //RISCVSIM_CONFIG_H
@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include "csr.h"
+#include "riscv_sim_framework.h"
+#include "cache.h"
+#include "TLB.h"
+
+extern HART_LOCAL struct cache_table instruction_cache;
+extern HART_LOCAL struct cache_table data_cache;
+extern HART_LOCAL struct tlb itlb;
+extern HART_LOCAL struct tlb dtlb;
+
+// A counter reads as its event count plus an adjustment, so writing it only changes the adjustment and the events
+// themselves are always counted whether or not a counter is looking at them
+struct hpm_counter {
+    uint8_t event;
+    uint64_t adjust;
+};
+
+HART_LOCAL struct pipeline_events pipeline_events;
+static HART_LOCAL uint64_t cycle_adjust = 0;
+static HART_LOCAL uint64_t instret_adjust = 0;
+static HART_LOCAL struct hpm_counter hpm_counters[HPM_COUNTERS];
+
+uint64_t hpm_event_count(uint8_t event) {
+    switch (event) {
+        case HPM_EVENT_ICACHE_MISS:
+            return instruction_cache.misses;
+        case HPM_EVENT_DCACHE_MISS:
+            return data_cache.misses;
+        case HPM_EVENT_ITLB_MISS:
+            return itlb.misses;
+        case HPM_EVENT_DTLB_MISS:
+            return dtlb.misses;
+        case HPM_EVENT_MISPREDICT:
+            return pipeline_events.mispredicts;
+        case HPM_EVENT_FETCH_STALL:
+            return pipeline_events.fetch_stall_cycles;
+        case HPM_EVENT_MEMORY_STALL:
+            return pipeline_events.memory_stall_cycles;
+    }
+    return 0;
+}
+
+// 1 if the CSR exists, with its value in *value
+uint8_t csr_read(uint32_t csr, uint64_t* value) {
+    if (csr == CSR_CYCLE || csr == CSR_TIME || csr == CSR_MCYCLE) {
+        *value = get_cycle_counter() + cycle_adjust;
+    } else if (csr == CSR_INSTRET || csr == CSR_MINSTRET) {
+        *value = pipeline_events.instructions_retired + instret_adjust;
+    } else if (csr >= CSR_HPMCOUNTER3 && csr < CSR_HPMCOUNTER3 + HPM_COUNTERS) {
+        struct hpm_counter* counter = &hpm_counters[csr - CSR_HPMCOUNTER3];
+        *value = hpm_event_count(counter->event) + counter->adjust;
+    } else if (csr >= CSR_MHPMCOUNTER3 && csr < CSR_MHPMCOUNTER3 + HPM_COUNTERS) {
+        struct hpm_counter* counter = &hpm_counters[csr - CSR_MHPMCOUNTER3];
+        *value = hpm_event_count(counter->event) + counter->adjust;
+    } else if (csr >= CSR_MHPMEVENT3 && csr < CSR_MHPMEVENT3 + HPM_COUNTERS) {
+        *value = hpm_counters[csr - CSR_MHPMEVENT3].event;
+    } else if (csr == CSR_MHARTID) {
+        *value = hart_id;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// 1 if the CSR exists and is writable; the user-level counters and mhartid are read-only
+uint8_t csr_write(uint32_t csr, uint64_t value) {
+    if (csr == CSR_MCYCLE) {
+        cycle_adjust = value - get_cycle_counter();
+    } else if (csr == CSR_MINSTRET) { // the write replaces the writing instruction's own increment
+        instret_adjust = value - (pipeline_events.instructions_retired + 1);
+    } else if (csr >= CSR_MHPMCOUNTER3 && csr < CSR_MHPMCOUNTER3 + HPM_COUNTERS) {
+        struct hpm_counter* counter = &hpm_counters[csr - CSR_MHPMCOUNTER3];
+        counter->adjust = value - hpm_event_count(counter->event);
+    } else if (csr >= CSR_MHPMEVENT3 && csr < CSR_MHPMEVENT3 + HPM_COUNTERS) {
+        // keeps counting from the current value, an unknown event reads back as 0 (WARL)
+        struct hpm_counter* counter = &hpm_counters[csr - CSR_MHPMEVENT3];
+        uint64_t current = hpm_event_count(counter->event) + counter->adjust;
+        counter->event = (uint8_t) (value < HPM_EVENTS ? value : HPM_EVENT_NONE);
+        counter->adjust = current - hpm_event_count(counter->event);
+    } else {
+        return 0;
+    }
+    return 1;
+}
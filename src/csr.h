@@ -0,0 +1,57 @@
+#ifndef RISCVSIM_CSR_H
+#define RISCVSIM_CSR_H
+
+#include <stdint.h>
+#include "hart.h"
+
+// Zicntr/Zihpm counters and the machine-level CSRs behind them
+#define CSR_CYCLE 0xC00
+#define CSR_TIME 0xC01 // no real-time clock, so time counts cycles
+#define CSR_INSTRET 0xC02
+#define CSR_HPMCOUNTER3 0xC03
+#define CSR_MCYCLE 0xB00
+#define CSR_MINSTRET 0xB02
+#define CSR_MHPMCOUNTER3 0xB03
+#define CSR_MHPMEVENT3 0x323
+#define CSR_MHARTID 0xF14
+
+#define HPM_COUNTERS 29 // mhpmcounter3 to mhpmcounter31
+
+// events an mhpmevent register selects for its counter; any other value counts nothing
+#define HPM_EVENT_NONE 0
+#define HPM_EVENT_ICACHE_MISS 1
+#define HPM_EVENT_DCACHE_MISS 2
+#define HPM_EVENT_ITLB_MISS 3
+#define HPM_EVENT_DTLB_MISS 4
+#define HPM_EVENT_MISPREDICT 5 // branches and jumps resolved to a different target than fetch predicted
+#define HPM_EVENT_FETCH_STALL 6 // cycles fetch waited on the I-TLB or I-cache
+#define HPM_EVENT_MEMORY_STALL 7 // cycles the memory stage waited on the D-TLB or D-cache
+#define HPM_EVENTS 8
+
+// CPI stack: what every cycle is charged to. A cycle in which an instruction retires is base, any other goes to what
+// kept the oldest instruction from retiring, the bubble it waits behind carrying the cause it was created by.
+#define CPI_BASE 0
+#define CPI_ICACHE_MISS 1
+#define CPI_ITLB_WALK 2
+#define CPI_DCACHE_MISS 3
+#define CPI_DTLB_WALK 4
+#define CPI_LOAD_USE 5 // decode waiting for a source operand, from a load or any result not yet forwardable
+#define CPI_MISPREDICT 6
+#define CPI_MEMORY_PORT 7 // the memory port was busy with another cache or the write buffer
+#define CPI_CAUSES 8
+
+// counted by the pipeline itself; cache and TLB misses are counted in their own structs
+struct pipeline_events {
+    uint64_t instructions_retired;
+    uint64_t mispredicts;
+    uint64_t fetch_stall_cycles;
+    uint64_t memory_stall_cycles;
+    uint64_t cpi_cycles[CPI_CAUSES];
+};
+
+extern HART_LOCAL struct pipeline_events pipeline_events;
+
+uint8_t csr_read(uint32_t csr, uint64_t* value);
+uint8_t csr_write(uint32_t csr, uint64_t value);
+
+#endif //RISCVSIM_CSR_H
@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include <stdio.h>
+#include "disassemble.h"
+
+// Turns the instructions the pipeline runs (RV64IMA and Zicsr) back into assembly, for the profile report.
+// Branch and jump targets are printed as absolute addresses; anything else comes out as .word.
+
+extern const char* abi_regs[];
+
+static const char* load_names[8] = {"lb", "lh", "lw", "ld", "lbu", "lhu", "lwu", NULL};
+static const char* store_names[8] = {"sb", "sh", "sw", "sd", NULL, NULL, NULL, NULL};
+static const char* branch_names[8] = {"beq", "bne", NULL, NULL, "blt", "bge", "bltu", "bgeu"};
+static const char* op_imm_names[8] = {"addi", "slli", "slti", "sltiu", "xori", NULL, "ori", "andi"};
+static const char* op_names[8] = {"add", "sll", "slt", "sltu", "xor", "srl", "or", "and"};
+static const char* op_32_names[8] = {"addw", "sllw", NULL, NULL, NULL, "srlw", NULL, NULL};
+static const char* muldiv_names[8] = {"mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu"};
+static const char* muldiv_32_names[8] = {"mulw", NULL, NULL, NULL, "divw", "divuw", "remw", "remuw"};
+static const char* csr_names[8] = {NULL, "csrrw", "csrrs", "csrrc", NULL, "csrrwi", "csrrsi", "csrrci"};
+
+static const char* amo_name(uint32_t funct5) {
+    switch (funct5) {
+        case 0b00010: return "lr";
+        case 0b00011: return "sc";
+        case 0b00001: return "amoswap";
+        case 0b00000: return "amoadd";
+        case 0b00100: return "amoxor";
+        case 0b01100: return "amoand";
+        case 0b01000: return "amoor";
+        case 0b10000: return "amomin";
+        case 0b10100: return "amomax";
+        case 0b11000: return "amominu";
+        case 0b11100: return "amomaxu";
+    }
+    return NULL;
+}
+
+static int64_t i_immediate(uint32_t instruction) {
+    return (int64_t) (int32_t) instruction >> 20;
+}
+
+static int64_t s_immediate(uint32_t instruction) {
+    return (int64_t) (int32_t) (instruction & 0xFE000000) >> 20 | (instruction >> 7 & 0x1F);
+}
+
+static int64_t b_immediate(uint32_t instruction) {
+    return (int64_t) (int32_t) (instruction & 0x80000000) >> 19 | (instruction << 4 & 0x800) | (instruction >> 20 & 0x7E0) | (instruction >> 7 & 0x1E);
+}
+
+static int64_t j_immediate(uint32_t instruction) {
+    return (int64_t) (int32_t) (instruction & 0x80000000) >> 11 | (instruction & 0xFF000) | (instruction >> 9 & 0x800) | (instruction >> 20 & 0x7FE);
+}
+
+void disassemble(uint32_t instruction, uint64_t pc, char* out, size_t size) {
+    uint32_t opcode = instruction & 0x7F;
+    const char* rd = abi_regs[instruction >> 7 & 0x1F];
+    const char* rs1 = abi_regs[instruction >> 15 & 0x1F];
+    const char* rs2 = abi_regs[instruction >> 20 & 0x1F];
+    uint32_t funct3 = instruction >> 12 & 0b111;
+    uint32_t funct7 = instruction >> 25;
+    const char* name = NULL;
+    switch (opcode) {
+        case 0b0110111:
+            snprintf(out, size, "lui %s, 0x%x", rd, instruction >> 12);
+            return;
+        case 0b0010111:
+            snprintf(out, size, "auipc %s, 0x%x", rd, instruction >> 12);
+            return;
+        case 0b1101111:
+            snprintf(out, size, "jal %s, 0x%lx", rd, (unsigned long) (pc + j_immediate(instruction)));
+            return;
+        case 0b1100111:
+            if (funct3 == 0) {
+                snprintf(out, size, "jalr %s, %ld(%s)", rd, (long) i_immediate(instruction), rs1);
+                return;
+            }
+            break;
+        case 0b1100011:
+            if ((name = branch_names[funct3]) != NULL) {
+                snprintf(out, size, "%s %s, %s, 0x%lx", name, rs1, rs2, (unsigned long) (pc + b_immediate(instruction)));
+                return;
+            }
+            break;
+        case 0b0000011:
+            if ((name = load_names[funct3]) != NULL) {
+                snprintf(out, size, "%s %s, %ld(%s)", name, rd, (long) i_immediate(instruction), rs1);
+                return;
+            }
+            break;
+        case 0b0100011:
+            if ((name = store_names[funct3]) != NULL) {
+                snprintf(out, size, "%s %s, %ld(%s)", name, rs2, (long) s_immediate(instruction), rs1);
+                return;
+            }
+            break;
+        case 0b0010011:
+            if (funct3 == 0b101) {
+                snprintf(out, size, "%s %s, %s, %u", instruction >> 30 & 1 ? "srai" : "srli", rd, rs1, instruction >> 20 & 0x3F);
+            } else if (funct3 == 0b001) {
+                snprintf(out, size, "slli %s, %s, %u", rd, rs1, instruction >> 20 & 0x3F);
+            } else {
+                snprintf(out, size, "%s %s, %s, %ld", op_imm_names[funct3], rd, rs1, (long) i_immediate(instruction));
+            }
+            return;
+        case 0b0011011:
+            if (funct3 == 0) {
+                snprintf(out, size, "addiw %s, %s, %ld", rd, rs1, (long) i_immediate(instruction));
+                return;
+            } else if (funct3 == 0b001) {
+                snprintf(out, size, "slliw %s, %s, %u", rd, rs1, instruction >> 20 & 0x1F);
+                return;
+            } else if (funct3 == 0b101) {
+                snprintf(out, size, "%s %s, %s, %u", instruction >> 30 & 1 ? "sraiw" : "srliw", rd, rs1, instruction >> 20 & 0x1F);
+                return;
+            }
+            break;
+        case 0b0110011:
+            if (funct7 == 1) {
+                name = muldiv_names[funct3];
+            } else if (funct7 == 0b0100000) {
+                name = funct3 == 0 ? "sub" : funct3 == 0b101 ? "sra" : NULL;
+            } else if (funct7 == 0) {
+                name = op_names[funct3];
+            }
+            if (name != NULL) {
+                snprintf(out, size, "%s %s, %s, %s", name, rd, rs1, rs2);
+                return;
+            }
+            break;
+        case 0b0111011:
+            if (funct7 == 1) {
+                name = muldiv_32_names[funct3];
+            } else if (funct7 == 0b0100000) {
+                name = funct3 == 0 ? "subw" : funct3 == 0b101 ? "sraw" : NULL;
+            } else if (funct7 == 0) {
+                name = op_32_names[funct3];
+            }
+            if (name != NULL) {
+                snprintf(out, size, "%s %s, %s, %s", name, rd, rs1, rs2);
+                return;
+            }
+            break;
+        case 0b0101111:
+            if ((name = amo_name(funct7 >> 2)) != NULL && (funct3 == 0b010 || funct3 == 0b011)) {
+                const char* width = funct3 == 0b010 ? "w" : "d";
+                if (funct7 >> 2 == 0b00010) {
+                    snprintf(out, size, "%s.%s %s, (%s)", name, width, rd, rs1);
+                } else {
+                    snprintf(out, size, "%s.%s %s, %s, (%s)", name, width, rd, rs2, rs1);
+                }
+                return;
+            }
+            break;
+        case 0b0001111:
+            snprintf(out, size, funct3 == 1 ? "fence.i" : "fence");
+            return;
+        case 0b1110011:
+            if (instruction == 0x00000073) {
+                snprintf(out, size, "ecall");
+                return;
+            } else if (instruction == 0x00100073) {
+                snprintf(out, size, "ebreak");
+                return;
+            } else if ((name = csr_names[funct3]) != NULL) {
+                if (funct3 & 0b100) {
+                    snprintf(out, size, "%s %s, 0x%x, %u", name, rd, instruction >> 20, instruction >> 15 & 0x1F);
+                } else {
+                    snprintf(out, size, "%s %s, 0x%x, %s", name, rd, instruction >> 20, rs1);
+                }
+                return;
+            }
+            break;
+    }
+    snprintf(out, size, ".word 0x%08x", instruction);
+}
@@ -0,0 +1,9 @@
+#ifndef RISCVSIM_DISASSEMBLE_H
+#define RISCVSIM_DISASSEMBLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+void disassemble(uint32_t instruction, uint64_t pc, char* out, size_t size);
+
+#endif //RISCVSIM_DISASSEMBLE_H
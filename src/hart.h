@@ -0,0 +1,14 @@
+# ifndef HART_H
+# define HART_H
+
+#include <stdint.h>
+
+// State every simulated hart keeps its own copy of. With the harts option above 1 each hart runs on its own host
+// thread, so a thread-local global is that hart's state; with a single hart this is an ordinary global.
+#define HART_LOCAL _Thread_local
+
+#define MAX_HARTS 16
+
+extern HART_LOCAL uint32_t hart_id;
+
+#endif
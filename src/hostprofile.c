@@ -0,0 +1,43 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "hostprofile.h"
+
+HART_LOCAL uint8_t hostprofiling = 0;
+HART_LOCAL uint64_t hostprofile_time[HOSTPROFILE_PARTS];
+HART_LOCAL uint64_t hostprofile_calls[HOSTPROFILE_PARTS]; // for the whole cycle, the simulated cycles profiled
+
+// indented under the part that calls them
+static const char* part_names[HOSTPROFILE_PARTS] = {"cycle", "  stage_writeback", "  stage_memory", "  stage_execute",
+                                                    "  stage_decode", "  stage_fetch", "    read_access", "    write_access",
+                                                    "    get_address", "      memory_read", "      memory_status"};
+
+// "hostprofile on" - drops the previous counts and starts again
+void hostprofile_start() {
+    memset(hostprofile_time, 0, sizeof(hostprofile_time));
+    memset(hostprofile_calls, 0, sizeof(hostprofile_calls));
+    hostprofiling = 1;
+}
+
+void hostprofile_stop() {
+    hostprofiling = 0;
+}
+
+// "hostprofile report" - host time per simulated cycle of every part, and how often it was called
+void hostprofile_report(FILE* out) {
+    uint64_t cycles = hostprofile_calls[HOSTPROFILE_CYCLE];
+    if (cycles == 0) {
+        fprintf(out, "No host profile, start one with \"hostprofile on\" before a run\n");
+        return;
+    }
+    fprintf(out, "%lu simulated cycles, %lu host %s\n", (unsigned long) cycles, (unsigned long) hostprofile_time[HOSTPROFILE_CYCLE],
+            HOSTPROFILE_UNIT);
+    fprintf(out, "%-20s %14s %12s %7s %12s %10s\n", "part", "host", "per cycle", "%", "calls/cycle", "per call");
+    for (int i = 0; i < HOSTPROFILE_PARTS; i++) {
+        uint64_t time = hostprofile_time[i];
+        uint64_t calls = hostprofile_calls[i];
+        fprintf(out, "%-20s %14lu %12.1f %6.2f%% %12.3f %10.1f\n", part_names[i], (unsigned long) time, (double) time / (double) cycles,
+                100.0 * (double) time / (double) hostprofile_time[HOSTPROFILE_CYCLE], (double) calls / (double) cycles,
+                calls ? (double) time / (double) calls : 0.0);
+    }
+}
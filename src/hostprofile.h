@@ -0,0 +1,66 @@
+#ifndef RISCVSIM_HOSTPROFILE_H
+#define RISCVSIM_HOSTPROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "hart.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HOSTPROFILE_UNIT "TSC cycles"
+#else
+#include <time.h>
+#define HOSTPROFILE_UNIT "ns"
+#endif
+
+// Host self-profile: the simulator's own time (time stamp counter cycles, or nanoseconds where there is no TSC) spent
+// in each pipeline stage and in the cache, TLB and memory calls they make. Parts nest: a stage includes the
+// read_access, write_access and get_address calls it makes, and those include their memory_read and memory_status
+// calls. The whole cycle also covers the framework's own work between the stages.
+#define HOSTPROFILE_CYCLE 0
+#define HOSTPROFILE_WRITEBACK 1
+#define HOSTPROFILE_MEMORY 2
+#define HOSTPROFILE_EXECUTE 3
+#define HOSTPROFILE_DECODE 4
+#define HOSTPROFILE_FETCH 5
+#define HOSTPROFILE_READ_ACCESS 6
+#define HOSTPROFILE_WRITE_ACCESS 7
+#define HOSTPROFILE_GET_ADDRESS 8
+#define HOSTPROFILE_MEMORY_READ 9
+#define HOSTPROFILE_MEMORY_STATUS 10
+#define HOSTPROFILE_PARTS 11
+
+extern HART_LOCAL uint8_t hostprofiling; // checked before reading the clock, so a run without a profile only pays the test
+extern HART_LOCAL uint64_t hostprofile_time[HOSTPROFILE_PARTS];
+extern HART_LOCAL uint64_t hostprofile_calls[HOSTPROFILE_PARTS];
+
+static inline uint64_t host_timestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+#endif
+}
+
+static inline void hostprofile_add(uint8_t part, uint64_t start) {
+    hostprofile_time[part] += host_timestamp() - start;
+    hostprofile_calls[part]++;
+}
+
+// runs call, and adds its host time to part if the profile is on
+#define HOSTPROFILE_TIME(part, call) do { \
+    if (hostprofiling) { \
+        uint64_t hostprofile_start = host_timestamp(); \
+        call; \
+        hostprofile_add(part, hostprofile_start); \
+    } else { \
+        call; \
+    } \
+} while (0)
+
+void hostprofile_start();
+void hostprofile_stop();
+void hostprofile_report(FILE* out);
+
+#endif //RISCVSIM_HOSTPROFILE_H
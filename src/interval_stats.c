@@ -0,0 +1,113 @@
+#include <stdint.h>
+#include <stdio.h>
+#include "interval_stats.h"
+#include "riscv_sim_framework.h"
+#include "cache.h"
+#include "TLB.h"
+#include "csr.h"
+
+extern HART_LOCAL struct cache_table instruction_cache;
+extern HART_LOCAL struct cache_table data_cache;
+extern HART_LOCAL struct tlb itlb;
+extern HART_LOCAL struct tlb dtlb;
+
+HART_LOCAL FILE* interval_output = NULL;
+static HART_LOCAL uint64_t interval_period;
+static HART_LOCAL uint8_t interval_unit;
+static HART_LOCAL uint8_t interval_format;
+static HART_LOCAL struct interval_record interval_last; // running totals at the end of the previous interval
+
+static void interval_totals(struct interval_record* totals) {
+    totals->cycle = get_cycle_counter();
+    totals->instructions = pipeline_events.instructions_retired;
+    totals->cycles = totals->cycle;
+    totals->retired = totals->instructions;
+    totals->icache_accesses = instruction_cache.accesses;
+    totals->icache_misses = instruction_cache.misses;
+    totals->dcache_accesses = data_cache.accesses;
+    totals->dcache_misses = data_cache.misses;
+    totals->itlb_accesses = itlb.accesses;
+    totals->itlb_misses = itlb.misses;
+    totals->dtlb_accesses = dtlb.accesses;
+    totals->dtlb_misses = dtlb.misses;
+    totals->mispredicts = pipeline_events.mispredicts;
+    get_memory_counters(&totals->memory_reads, &totals->memory_writes);
+}
+
+static double hit_rate(uint64_t accesses, uint64_t misses) {
+    return accesses > misses ? (double) (accesses - misses) / (double) accesses : 0.0;
+}
+
+static void interval_write() {
+    struct interval_record totals;
+    interval_totals(&totals);
+    struct interval_record record;
+    record.cycle = totals.cycle;
+    record.instructions = totals.instructions;
+    record.cycles = totals.cycles - interval_last.cycles;
+    record.retired = totals.retired - interval_last.retired;
+    record.icache_accesses = totals.icache_accesses - interval_last.icache_accesses;
+    record.icache_misses = totals.icache_misses - interval_last.icache_misses;
+    record.dcache_accesses = totals.dcache_accesses - interval_last.dcache_accesses;
+    record.dcache_misses = totals.dcache_misses - interval_last.dcache_misses;
+    record.itlb_accesses = totals.itlb_accesses - interval_last.itlb_accesses;
+    record.itlb_misses = totals.itlb_misses - interval_last.itlb_misses;
+    record.dtlb_accesses = totals.dtlb_accesses - interval_last.dtlb_accesses;
+    record.dtlb_misses = totals.dtlb_misses - interval_last.dtlb_misses;
+    record.mispredicts = totals.mispredicts - interval_last.mispredicts;
+    record.memory_reads = totals.memory_reads - interval_last.memory_reads;
+    record.memory_writes = totals.memory_writes - interval_last.memory_writes;
+    interval_last = totals;
+    if (interval_format == INTERVAL_BINARY) {
+        fwrite(&record, sizeof(struct interval_record), 1, interval_output);
+        return;
+    }
+    fprintf(interval_output, "%lu,%lu,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%lu\n",
+            (unsigned long) record.cycle, (unsigned long) record.instructions, (unsigned long) record.cycles, (unsigned long) record.retired,
+            record.cycles ? (double) record.retired / (double) record.cycles : 0.0,
+            (unsigned long) record.icache_accesses, (unsigned long) record.icache_misses, hit_rate(record.icache_accesses, record.icache_misses),
+            (unsigned long) record.dcache_accesses, (unsigned long) record.dcache_misses, hit_rate(record.dcache_accesses, record.dcache_misses),
+            (unsigned long) record.itlb_accesses, (unsigned long) record.itlb_misses, hit_rate(record.itlb_accesses, record.itlb_misses),
+            (unsigned long) record.dtlb_accesses, (unsigned long) record.dtlb_misses, hit_rate(record.dtlb_accesses, record.dtlb_misses),
+            (unsigned long) record.mispredicts, (unsigned long) record.memory_reads, (unsigned long) record.memory_writes);
+}
+
+// "intervalstats" command - a sample every period cycles or retired instructions, counted from now
+void interval_stats_start(const char* file, uint64_t period, uint8_t unit, uint8_t format) {
+    interval_stats_stop();
+    interval_output = fopen(file, format == INTERVAL_BINARY ? "wb" : "w");
+    if (interval_output == NULL) {
+        fprintf(stderr, "intervalstats: cannot open %s\n", file);
+        return;
+    }
+    interval_period = period;
+    interval_unit = unit;
+    interval_format = format;
+    interval_totals(&interval_last);
+    if (format == INTERVAL_CSV) {
+        fprintf(interval_output, "cycle,instructions,cycles,retired,ipc,icache_accesses,icache_misses,icache_hit_rate,dcache_accesses,"
+                                 "dcache_misses,dcache_hit_rate,itlb_accesses,itlb_misses,itlb_hit_rate,dtlb_accesses,dtlb_misses,"
+                                 "dtlb_hit_rate,mispredicts,memory_reads,memory_writes\n");
+    }
+}
+
+// writes out the interval in progress, if it has any cycles, and closes the file
+void interval_stats_stop() {
+    if (interval_output == NULL) {
+        return;
+    }
+    if (get_cycle_counter() != interval_last.cycle) {
+        interval_write();
+    }
+    fclose(interval_output);
+    interval_output = NULL;
+}
+
+// called at the start of every cycle, so the counters hold everything up to the end of the last one
+void interval_stats_cycle() {
+    uint64_t elapsed = interval_unit == INTERVAL_INSTRUCTIONS ? pipeline_events.instructions_retired - interval_last.instructions
+                                                              : get_cycle_counter() - interval_last.cycle;
+    if (elapsed >= interval_period) {
+        interval_write();
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef RISCVSIM_INTERVAL_STATS_H
+#define RISCVSIM_INTERVAL_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "hart.h"
+
+#define INTERVAL_CYCLES 0
+#define INTERVAL_INSTRUCTIONS 1
+
+#define INTERVAL_CSV 0
+#define INTERVAL_BINARY 1
+
+// One sample of the "intervalstats" time series; the binary format is these records back to back, the CSV format has
+// the same columns plus IPC and hit rates. Every field but the first two counts the interval alone.
+struct interval_record {
+    uint64_t cycle; // cycles simulated at the end of the interval
+    uint64_t instructions; // instructions retired by then
+    uint64_t cycles;
+    uint64_t retired;
+    uint64_t icache_accesses;
+    uint64_t icache_misses;
+    uint64_t dcache_accesses;
+    uint64_t dcache_misses;
+    uint64_t itlb_accesses;
+    uint64_t itlb_misses;
+    uint64_t dtlb_accesses;
+    uint64_t dtlb_misses;
+    uint64_t mispredicts;
+    uint64_t memory_reads;
+    uint64_t memory_writes;
+};
+
+extern HART_LOCAL FILE* interval_output; // checked every cycle, NULL unless a time series is being written
+
+void interval_stats_start(const char* file, uint64_t period, uint8_t unit, uint8_t format);
+void interval_stats_stop();
+void interval_stats_cycle();
+
+#endif //RISCVSIM_INTERVAL_STATS_H
@@ -0,0 +1,675 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "riscv.h"
+#include "riscv_sim_framework.h"
+#include "riscv_pipeline_registers.h"
+#include "riscv_pipeline_registers_vars.h"
+#include "branch_predictor.h"
+#include "cache.h"
+#include "csr.h"
+#include "TLB.h"
+#include "mem.h"
+#include "ooo_core.h"
+#include "hart.h"
+#include "profile.h"
+#include "plugin_host.h"
+#include "pipeview.h"
+
+// Notes on structure: the out-of-order back end shares fetch (branch prediction, I-cache, I-TLB) with the five stage
+// pipeline and replaces everything after it. The stage functions map onto it as
+//   decode     - renames up to two fetched instructions into the ROB, the issue queue and the load or store queue
+//   execute    - issues the oldest ready instructions (issue_width per cycle) through the riscv_* handlers, resolves
+//                branches and squashes everything younger on a mispredict
+//   memory     - one D-cache access per cycle: the oldest committed store, else the oldest load whose older stores
+//                are all known (forwarding from an exactly matching one)
+//   writeback  - commits up to issue_width completed instructions in order, writing the register file and training
+//                the branch predictors
+// Renaming goes through the ROB: a source is read from the register file when no in-flight instruction writes it,
+// from the ROB when its producer has completed, or waits in the issue queue for the producer's ROB entry.
+// Results wake the issue queue at the end of execute, so dependent ALU instructions issue back to back and a load's
+// consumer issues two cycles after the load computed its address, as in the in-order pipeline.
+// Loads never pass a store with an unknown address (no memory dependence speculation). Stores write the D-cache only
+// once committed, so squashing never has to undo memory. Atomics take a store queue entry and are done once they reach
+// the head of the ROB with every older store written, and no younger load passes them.
+
+#define INSTRUCTION_EBREAK 0x00100073
+
+// from riscv_virtualizer.c
+extern HART_LOCAL void (*major_dispatch_table[128]) (uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg);
+extern HART_LOCAL struct cache_table data_cache;
+extern HART_LOCAL struct tlb dtlb;
+extern HART_LOCAL uint8_t execute_redirected;
+extern HART_LOCAL uint8_t decode_redirected;
+extern HART_LOCAL uint8_t illegal_instruction_deferred;
+extern HART_LOCAL uint8_t illegal_instruction_seen;
+extern HART_LOCAL FILE* branch_trace;
+extern HART_LOCAL struct branch_trace_record pending_trace_record;
+extern HART_LOCAL uint32_t trace_instructions;
+int64_t jal_offset(struct riscv_instruction instruction);
+struct operand_usage instruction_operands(uint32_t instruction);
+void prepare_atomic_update(uint8_t funct5, uint64_t operand, uint8_t size, struct atomic_update* update);
+
+HART_LOCAL struct ooo_core core;
+
+void construct_ooo_core(uint32_t rob_entries, uint32_t iq_entries, uint32_t lsq_entries, uint32_t width) {
+    if (rob_entries == 0 || rob_entries > 0x7FFFFFFF || iq_entries == 0 || lsq_entries == 0) {
+        printf("out-of-order core needs ROB, issue queue and load/store queue entries\n");
+        exit(1);
+    }
+    memset(&core, 0, sizeof(struct ooo_core));
+    core.rob = scalloc(rob_entries * sizeof(struct rob_entry));
+    core.rob_entries = rob_entries;
+    core.iq = scalloc(iq_entries * sizeof(struct iq_entry));
+    core.iq_entries = iq_entries;
+    core.load_queue = scalloc(lsq_entries * sizeof(struct load_queue_entry));
+    core.store_queue = scalloc(lsq_entries * sizeof(struct store_queue_entry));
+    core.lsq_entries = lsq_entries;
+    core.wakeups = scalloc(rob_entries * sizeof(uint32_t));
+    core.width = width;
+    for (int i = 0; i < 32; i++) {
+        core.rename_table[i] = -1;
+    }
+}
+
+// position of a ROB entry behind the head, the oldest instruction is 0
+uint32_t rob_age(uint32_t index) {
+    return (index + core.rob_entries - core.rob_head) % core.rob_entries;
+}
+
+uint8_t rob_live(uint32_t index, uint64_t seq) {
+    return rob_age(index) < core.rob_count && core.rob[index].seq == seq;
+}
+
+// Fetch waits in front of an ebreak until everything before it has committed; the framework ends the run once
+// the pc sits on an ebreak and the core has drained
+uint8_t ooo_fetch_blocked() {
+    uint32_t instruction = 0;
+    memory_read_direct(get_pc(), &instruction, 4);
+    return instruction == INSTRUCTION_EBREAK;
+}
+
+uint8_t ooo_drained() {
+    return core.rob_count == 0 && core.store_head == core.store_tail && !current_stage_d_register->not_stalled;
+}
+
+// the instruction the profile charges this cycle to: the head of the ROB, or the one being fetched if it is empty
+uint64_t ooo_oldest_pc() {
+    return core.rob_count > 0 ? core.rob[core.rob_head].pc : get_pc();
+}
+
+void ooo_complete(uint32_t index, uint64_t value) {
+    core.rob[index].value = value;
+    core.rob[index].completed = 1;
+    core.wakeups[core.wakeup_count++] = index;
+}
+
+// Commit
+
+// CPI stack cause of a D-cache access that is waiting
+uint8_t ooo_access_cause(const struct ooo_memory_access* access) {
+    if (access->was_stalled == 2) {
+        return CPI_MEMORY_PORT;
+    }
+    return (uint8_t) (access->stall_status != 0xFF ? CPI_DTLB_WALK : CPI_DCACHE_MISS);
+}
+
+// CPI stack cause of a cycle nothing committed in: the head of the ROB waiting on its D-cache access (or on the port
+// while another access holds it), the refill after a mispredict, or the front end when the ROB ran empty
+uint8_t ooo_stall_cause() {
+    const struct rob_entry* head = &core.rob[core.rob_head];
+    if (core.rob_count > 0 && (head->load >= 0 || head->store >= 0)) {
+        const struct ooo_memory_access* access = &core.access;
+        // a committed store's access may name a ROB slot that has been reused since
+        uint8_t own = access->rob == core.rob_head && (access->atomic || (!access->store && access->seq == head->seq));
+        if (access->active && own && access->was_stalled) {
+            return ooo_access_cause(access);
+        }
+        if (access->active && !own) {
+            return CPI_MEMORY_PORT;
+        }
+    }
+    if (core.refill_seq != 0 && (core.rob_count == 0 || head->seq >= core.refill_seq)) {
+        return CPI_MISPREDICT;
+    }
+    return core.rob_count == 0 ? core.frontend_cause : (uint8_t) CPI_BASE;
+}
+
+void ooo_commit() {
+    uint32_t committed = 0;
+    for (; committed < core.width && core.rob_count > 0; committed++) {
+        uint32_t index = core.rob_head;
+        struct rob_entry* entry = &core.rob[index];
+        if (!entry->completed) {
+            break;
+        }
+        if (entry->seq >= core.refill_seq) {
+            core.refill_seq = 0;
+        }
+        uint32_t raw_instruction;
+        memcpy(&raw_instruction, &entry->instruction, sizeof(raw_instruction));
+        if (entry->illegal) {
+            printf("Illegal instruction @ 0x%016lX: 0x%08X\n", entry->pc, raw_instruction);
+        }
+        if (entry->rd > 0) {
+            register_write((uint64_t) entry->rd, entry->value);
+            if (core.rename_table[entry->rd] == (int32_t) index) {
+                core.rename_table[entry->rd] = -1;
+            }
+        }
+        if (entry->load >= 0) {
+            if (plugin_hooks & PLUGIN_HOOK_MEMORY) {
+                const struct load_queue_entry* load = &core.load_queue[entry->load];
+                plugin_memory(entry->pc, load->address, load->physical_address, load->size, PLUGIN_LOAD);
+            }
+            core.load_head = (core.load_head + 1) % core.lsq_entries;
+            core.load_count--;
+        }
+        if (entry->store >= 0) {
+            core.store_queue[entry->store % core.lsq_entries].committed = 1;
+        }
+        pipeline_events.instructions_retired++;
+        if (pipeview != NULL) {
+            pipeview_retired(entry->trace_id);
+        }
+        if (plugin_hooks & PLUGIN_HOOK_RETIRE) {
+            plugin_retire(entry->pc, raw_instruction);
+        }
+        // the predictors learn in program order, wrong-path branches never train them
+        uint8_t taken = entry->new_pc != entry->pc + 4;
+        uint8_t conditional = entry->instruction.data.u.opcode == 0b1100011;
+        if (conditional) {
+            update_direction(entry->pc, entry->bp_history, taken);
+        }
+        if (entry->instruction.data.u.opcode == 0b1100111) {
+            update_indirect(entry->pc, raw_instruction, entry->path_history, entry->new_pc);
+        }
+        if (taken) {
+            update_entry(entry->pc, entry->new_pc, conditional);
+        }
+        if ((plugin_hooks & PLUGIN_HOOK_BRANCH) && branch_type(raw_instruction) != BRANCH_NONE) {
+            plugin_branch(entry->pc, entry->new_pc, taken, entry->mispredicted);
+        }
+        if (branch_trace != NULL) {
+            trace_instructions++;
+            pending_trace_record.type = branch_type(raw_instruction);
+            if (pending_trace_record.type != BRANCH_NONE) {
+                pending_trace_record.pc = entry->pc;
+                pending_trace_record.target = entry->new_pc;
+                pending_trace_record.taken = taken;
+                pending_trace_record.instructions = trace_instructions;
+                fwrite(&pending_trace_record, sizeof(struct branch_trace_record), 1, branch_trace);
+                trace_instructions = 0;
+            }
+        }
+        core.rob_head = (core.rob_head + 1) % core.rob_entries;
+        core.rob_count--;
+    }
+    pipeline_events.cpi_cycles[committed > 0 ? CPI_BASE : ooo_stall_cause()]++;
+}
+
+// Memory
+
+uint64_t extend_load(uint64_t value, uint8_t size, uint8_t sign_extend) {
+    if (size < 8) {
+        value &= (1ULL << (size * 8)) - 1;
+        if (sign_extend && value >> (size * 8 - 1)) {
+            value |= ~0ULL << (size * 8);
+        }
+    }
+    return value;
+}
+
+// 1 if the load may go ahead of the stores older than it; *forward is set to the youngest one holding exactly its data
+uint8_t load_ready(const struct load_queue_entry* load, const struct store_queue_entry** forward) {
+    *forward = NULL;
+    for (uint64_t position = core.store_head; position < load->older_stores; position++) {
+        const struct store_queue_entry* store = &core.store_queue[position % core.lsq_entries];
+        if (!store->address_ready || store->atomic) {
+            return 0;
+        }
+        if (store->address < load->address + load->size && load->address < store->address + store->size) {
+            if (store->address != load->address || store->size < load->size) {
+                return 0; // partial overlap, wait for the store to reach the cache
+            }
+            *forward = store;
+        }
+    }
+    return 1;
+}
+
+// 1 if the oldest store (or atomic) may be written to the D-cache now
+uint8_t store_ready() {
+    if (core.store_head == core.store_tail) {
+        return 0;
+    }
+    const struct store_queue_entry* store = &core.store_queue[core.store_head % core.lsq_entries];
+    return (uint8_t) (store->atomic ? store->address_ready && rob_age(store->rob) == 0 : store->committed);
+}
+
+// starts the D-cache access of the oldest store, which store_ready allows
+void ooo_start_store() {
+    struct ooo_memory_access* access = &core.access;
+    struct store_queue_entry* store = &core.store_queue[core.store_head % core.lsq_entries];
+    if (store->size == 0) { // not a valid store, nothing to write
+        core.store_head++;
+        return;
+    }
+    memset(access, 0, sizeof(struct ooo_memory_access));
+    access->active = 1;
+    access->store = 1;
+    access->atomic = store->atomic;
+    access->operation = store->operation;
+    access->rob = store->rob;
+    access->pc = store->pc;
+    access->address = store->address;
+    access->value = store->value;
+    access->size = store->size;
+}
+
+// picks the next D-cache access, a load forwarded from the store queue completes right away. A ready store goes
+// first: the load before it has usually just brought in its translation and block, which every load let past it
+// (one access at a time) could push out again
+void ooo_start_access() {
+    struct ooo_memory_access* access = &core.access;
+    if (store_ready()) {
+        ooo_start_store();
+        return;
+    }
+    for (uint32_t i = 0; i < core.load_count; i++) {
+        struct load_queue_entry* load = &core.load_queue[(core.load_head + i) % core.lsq_entries];
+        const struct store_queue_entry* forward;
+        // the D-cache stops the simulation on a misaligned access, so only a non-speculative one may make it
+        if (load->issued || !load->address_ready || ((load->address & 0b11) && rob_age(load->rob) != 0) ||
+            (load->faulted && rob_age(load->rob) != 0) || !load_ready(load, &forward)) {
+            continue;
+        }
+        load->issued = 1;
+        if (forward != NULL) {
+            load->physical_address = (uint64_t) -1;
+            ooo_complete(load->rob, extend_load(forward->value, load->size, load->sign_extend));
+            return;
+        }
+        memset(access, 0, sizeof(struct ooo_memory_access));
+        access->active = 1;
+        access->rob = load->rob;
+        access->seq = core.rob[load->rob].seq;
+        access->pc = core.rob[load->rob].pc;
+        access->address = load->address;
+        access->size = load->size;
+        access->sign_extend = load->sign_extend;
+        return;
+    }
+}
+
+// D-TLB and D-cache access with the same stall handling as the memory stage of the pipeline, returns 1 when done
+uint8_t ooo_access_memory(struct ooo_memory_access* access) {
+    uint32_t physical_address = 0;
+    uint8_t status = get_address(&dtlb, (uint32_t) access->address, &physical_address, access->was_stalled ? access->stall_status : (uint8_t) 0xFF);
+    uint8_t memory_read_available = 0;
+    if (status == 0xFE) {
+        memory_read_available = 1;
+    } else if (status != 0xFF) {
+        access->was_stalled = 1;
+        access->stall_status = status;
+        return 0;
+    }
+    access->physical_address = physical_address;
+    uint8_t is_followup = access->was_stalled == 1 && access->stall_status == 0xFF;
+    uint8_t missed;
+    if (access->atomic) {
+        struct atomic_update update;
+        prepare_atomic_update(access->operation, access->value, access->size, &update);
+        missed = atomic_access(&data_cache, physical_address, &update, &access->value, is_followup, memory_read_available);
+    } else if (access->store) {
+        missed = write_access(&data_cache, physical_address, access->value, access->size, is_followup, memory_read_available);
+    } else {
+        access->value = 0;
+        missed = read_access(&data_cache, physical_address, access->size, &access->value, is_followup, memory_read_available);
+    }
+    if (missed) {
+        access->was_stalled = (uint8_t) (missed == 2 ? 2 : 1);
+        access->stall_status = 0xFF;
+        return 0;
+    }
+    return 1;
+}
+
+void ooo_memory() {
+    struct ooo_memory_access* access = &core.access;
+    // a squashed load is dropped, unless a fill or page walk is outstanding: that one is waited for and thrown away
+    // rather than left behind in a memory slot
+    if (access->active && !access->store && access->was_stalled != 1 && !rob_live(access->rob, access->seq)) {
+        access->active = 0;
+    }
+    if (!access->active) {
+        ooo_start_access();
+        if (!access->active) {
+            return;
+        }
+    }
+    uint8_t done = ooo_access_memory(access);
+    if (profiling) {
+        profile_memory(access->pc);
+    }
+    if (!done) {
+        pipeline_events.memory_stall_cycles++;
+        // a committed store has no ROB entry left to show the stall on
+        if (pipeview != NULL && (access->atomic || (!access->store && rob_live(access->rob, access->seq)))) {
+            pipeview_note(core.rob[access->rob].trace_id, PIPEVIEW_STALL, ooo_access_cause(access));
+        }
+        // a walk that found no mapping (0x80) is final and leaves no read outstanding. A load behind the head of the
+        // ROB may be on a wrong path, so it gives up the port and waits to be squashed or to reach the head, where a
+        // real page fault stalls the core as it does the pipeline
+        if (!access->store && access->stall_status == 0x80 && !(rob_live(access->rob, access->seq) && rob_age(access->rob) == 0)) {
+            if (rob_live(access->rob, access->seq)) {
+                struct load_queue_entry* load = &core.load_queue[core.rob[access->rob].load];
+                load->issued = 0;
+                load->faulted = 1;
+            }
+            access->active = 0;
+        }
+        return;
+    }
+    access->active = 0;
+    // a load is reported when it commits, a store or atomic here since it is past commit or at the ROB head already
+    if ((plugin_hooks & PLUGIN_HOOK_MEMORY) && access->store) {
+        plugin_memory(access->pc, access->address, access->physical_address, access->size, (uint8_t) (access->atomic ? PLUGIN_ATOMIC : PLUGIN_STORE));
+    }
+    if (access->atomic) {
+        ooo_complete(access->rob, extend_load(access->value, access->size, 1));
+        core.rob[access->rob].store = -1; // already done, commit has nothing left to write
+        core.store_head++;
+    } else if (access->store) {
+        core.store_head++;
+    } else if (rob_live(access->rob, access->seq)) {
+        core.load_queue[core.rob[access->rob].load].physical_address = access->physical_address;
+        ooo_complete(access->rob, extend_load(access->value, access->size, access->sign_extend));
+    }
+}
+
+// Execute
+
+void ooo_squash_after(uint32_t index) {
+    uint32_t keep = rob_age(index) + 1;
+    while (core.rob_count > keep) {
+        struct rob_entry* entry = &core.rob[(core.rob_head + core.rob_count - 1) % core.rob_entries];
+        if (pipeview != NULL) {
+            pipeview_note(entry->trace_id, PIPEVIEW_FLUSH, CPI_MISPREDICT);
+        }
+        if (entry->load >= 0) {
+            core.load_count--;
+        }
+        if (entry->store >= 0) {
+            core.store_tail--;
+        }
+        core.rob_count--;
+    }
+    for (uint32_t i = 0; i < core.iq_entries; i++) {
+        if (core.iq[i].valid && rob_age(core.iq[i].rob) >= core.rob_count) {
+            core.iq[i].valid = 0;
+        }
+    }
+    for (int i = 0; i < 32; i++) {
+        core.rename_table[i] = -1;
+    }
+    for (uint32_t i = 0; i < core.rob_count; i++) {
+        uint32_t survivor = (core.rob_head + i) % core.rob_entries;
+        if (core.rob[survivor].rd > 0) {
+            core.rename_table[core.rob[survivor].rd] = (int32_t) survivor;
+        }
+    }
+}
+
+// runs the instruction through the riscv_* handlers, which read their operands from current_stage_x_register
+void ooo_issue(struct iq_entry* slot) {
+    uint32_t index = slot->rob;
+    struct rob_entry* entry = &core.rob[index];
+    uint32_t raw_instruction;
+    memcpy(&raw_instruction, &entry->instruction, sizeof(raw_instruction));
+    struct stage_reg_x operands;
+    memset(&operands, 0, sizeof(struct stage_reg_x));
+    operands.pc = entry->pc;
+    operands.instruction = entry->instruction;
+    operands.not_stalled = 1;
+    operands.rs1_value = slot->value[0];
+    operands.rs2_value = slot->value[1];
+    struct stage_reg_m result;
+    memset(&result, 0, sizeof(struct stage_reg_m));
+    uint64_t pc = entry->pc + 4;
+    slot->valid = 0;
+    entry->issued = 1;
+    if (pipeview != NULL) {
+        pipeview_stage(entry->trace_id, "X");
+    }
+    if (raw_instruction != 0) { // 0x00000000 is a nop, as in the pipeline
+        const struct stage_reg_x* pipeline_operands = current_stage_x_register;
+        current_stage_x_register = &operands;
+        illegal_instruction_deferred = 1;
+        illegal_instruction_seen = 0;
+        major_dispatch_table[entry->instruction.data.u.opcode](&pc, entry->instruction, &result);
+        illegal_instruction_deferred = 0;
+        entry->illegal = illegal_instruction_seen;
+        current_stage_x_register = pipeline_operands;
+    }
+    if (result.readWrite == 4) { // completes once the D-cache has done it
+        struct store_queue_entry* store = &core.store_queue[entry->store % core.lsq_entries];
+        store->address = result.address;
+        store->value = result.value;
+        store->size = result.size;
+        store->atomic = 1;
+        store->operation = result.amo;
+        store->address_ready = 1;
+    } else if (result.readWrite == 2) {
+        struct load_queue_entry* load = &core.load_queue[entry->load];
+        load->address = result.address;
+        load->size = result.size;
+        load->sign_extend = result.signExtend;
+        load->address_ready = 1;
+    } else {
+        if (entry->store >= 0) {
+            struct store_queue_entry* store = &core.store_queue[entry->store % core.lsq_entries];
+            store->address = result.address;
+            store->value = result.value;
+            store->size = (uint8_t) (result.readWrite == 1 ? result.size : 0);
+            store->address_ready = 1;
+        }
+        ooo_complete(index, result.readWrite == 3 ? result.value : 0);
+    }
+    if (pc != entry->new_pc) { // mispredict, refetch from the resolved target
+        pipeline_events.mispredicts++;
+        if (profiling) {
+            profile_mispredict(entry->pc);
+        }
+        core.refill_seq = core.seq + 1;
+        entry->mispredicted = 1;
+        entry->new_pc = pc;
+        set_pc(pc);
+        execute_redirected = 1;
+        ras_repair(entry->ras_top, entry->ras_value, entry->pc, raw_instruction);
+        ooo_squash_after(index);
+    }
+}
+
+// CSR instructions read and write the counters, so they only issue once every older instruction has committed
+uint8_t issue_blocked(const struct iq_entry* slot) {
+    const struct riscv_instruction* instruction = &core.rob[slot->rob].instruction;
+    return instruction->data.i.opcode == 0b1110011 && instruction->data.i.funct3 != 0 && rob_age(slot->rob) != 0;
+}
+
+void ooo_execute() {
+    execute_redirected = 0;
+    for (uint32_t issued = 0; issued < core.width; issued++) {
+        struct iq_entry* oldest = NULL;
+        for (uint32_t i = 0; i < core.iq_entries; i++) {
+            struct iq_entry* slot = &core.iq[i];
+            if (slot->valid && slot->source[0] < 0 && slot->source[1] < 0 && !issue_blocked(slot) && (oldest == NULL || rob_age(slot->rob) < rob_age(oldest->rob))) {
+                oldest = slot;
+            }
+        }
+        if (oldest == NULL) {
+            break;
+        }
+        ooo_issue(oldest);
+    }
+    // results reach the issue queue for next cycle's select
+    for (uint32_t i = 0; i < core.wakeup_count; i++) {
+        uint32_t producer = core.wakeups[i];
+        for (uint32_t j = 0; j < core.iq_entries; j++) {
+            struct iq_entry* slot = &core.iq[j];
+            for (int source = 0; source < 2; source++) {
+                if (slot->valid && slot->source[source] == (int32_t) producer) {
+                    slot->value[source] = core.rob[producer].value;
+                    slot->source[source] = -1;
+                }
+            }
+        }
+    }
+    core.wakeup_count = 0;
+}
+
+// Dispatch
+
+struct iq_entry* free_iq_slot() {
+    for (uint32_t i = 0; i < core.iq_entries; i++) {
+        if (!core.iq[i].valid) {
+            return &core.iq[i];
+        }
+    }
+    return NULL;
+}
+
+// renames one instruction into the back end, returns 0 if the ROB, the issue queue or its load/store queue is full
+uint8_t ooo_dispatch_one(const struct stage_reg_d* fetched, uint64_t pc, uint32_t raw_instruction, uint64_t new_pc, uint64_t trace_id) {
+    uint8_t opcode = (uint8_t) (raw_instruction & 0x7F);
+    uint8_t load = opcode == 0b0000011;
+    uint8_t store = opcode == 0b0100011 || opcode == 0b0101111; // atomics are ordered with the stores
+    struct iq_entry* slot = free_iq_slot();
+    if (core.rob_count == core.rob_entries || slot == NULL || (load && core.load_count == core.lsq_entries) ||
+        (store && core.store_tail - core.store_head == core.lsq_entries)) {
+        return 0;
+    }
+    uint32_t index = (core.rob_head + core.rob_count++) % core.rob_entries;
+    struct rob_entry* entry = &core.rob[index];
+    memset(entry, 0, sizeof(struct rob_entry));
+    entry->seq = ++core.seq;
+    entry->pc = pc;
+    entry->new_pc = new_pc;
+    entry->bp_history = fetched->bp_history;
+    entry->path_history = fetched->path_history;
+    entry->ras_top = fetched->ras_top;
+    entry->ras_value = fetched->ras_value;
+    memcpy(&entry->instruction, &raw_instruction, sizeof(raw_instruction));
+    entry->load = -1;
+    entry->store = -1;
+    entry->trace_id = trace_id;
+    if (load) {
+        entry->load = (int32_t) ((core.load_head + core.load_count++) % core.lsq_entries);
+        memset(&core.load_queue[entry->load], 0, sizeof(struct load_queue_entry));
+        core.load_queue[entry->load].rob = index;
+        core.load_queue[entry->load].older_stores = core.store_tail;
+    }
+    if (store) {
+        entry->store = (int64_t) core.store_tail;
+        memset(&core.store_queue[core.store_tail % core.lsq_entries], 0, sizeof(struct store_queue_entry));
+        core.store_queue[core.store_tail % core.lsq_entries].rob = index;
+        core.store_queue[core.store_tail % core.lsq_entries].pc = pc;
+        core.store_tail++;
+    }
+
+    struct operand_usage usage = instruction_operands(raw_instruction);
+    int16_t sources[2];
+    sources[0] = (int16_t) (usage.rs1 ? entry->instruction.data.r.rs1 : -1);
+    sources[1] = (int16_t) (usage.rs2 ? entry->instruction.data.r.rs2 : -1);
+    uint8_t from_file[2] = {0, 0};
+    slot->valid = 1;
+    slot->rob = index;
+    for (int i = 0; i < 2; i++) {
+        slot->source[i] = -1;
+        slot->value[i] = 0;
+        if (sources[i] <= 0) {
+            continue; // unused operand or x0
+        }
+        int32_t producer = core.rename_table[sources[i]];
+        if (producer < 0) {
+            from_file[i] = 1;
+        } else if (core.rob[producer].completed) {
+            slot->value[i] = core.rob[producer].value;
+        } else {
+            slot->source[i] = producer;
+        }
+    }
+    if (from_file[0] || from_file[1]) {
+        uint64_t value_a = 0;
+        uint64_t value_b = 0;
+        register_read((uint64_t) (from_file[0] ? sources[0] : sources[1]), (uint64_t) (from_file[1] ? sources[1] : sources[0]), &value_a, &value_b);
+        if (from_file[0]) {
+            slot->value[0] = value_a;
+        }
+        if (from_file[1]) {
+            slot->value[1] = value_b;
+        }
+    }
+    entry->rd = -1;
+    if (usage.rd && entry->instruction.data.r.rd != 0) {
+        entry->rd = entry->instruction.data.r.rd;
+        core.rename_table[entry->rd] = (int32_t) index;
+    }
+    return 1;
+}
+
+void ooo_dispatch() {
+    const struct stage_reg_d* fetched = current_stage_d_register;
+    if (!fetched->not_stalled || execute_redirected) {
+        if (!fetched->not_stalled) {
+            core.frontend_cause = fetched->bubble;
+        } else if (pipeview != NULL) {
+            pipeview_note(fetched->trace_id, PIPEVIEW_FLUSH, CPI_MISPREDICT);
+            pipeview_note(fetched->trace_id2, PIPEVIEW_FLUSH, CPI_MISPREDICT);
+        }
+        return;
+    }
+    if (!ooo_dispatch_one(fetched, fetched->pc, fetched->instruction, fetched->dual ? fetched->pc + 4 : fetched->new_pc, fetched->trace_id)) {
+        // window full, fetch it again
+        set_pc(fetched->pc);
+        ras_repair(fetched->ras_top, fetched->ras_value, 0, 0);
+        if (pipeview != NULL) {
+            pipeview_note(fetched->trace_id, PIPEVIEW_STALL, PIPEVIEW_WINDOW_FULL);
+            pipeview_note(fetched->trace_id2, PIPEVIEW_STALL, PIPEVIEW_WINDOW_FULL);
+        }
+        return;
+    }
+    if (fetched->dual && !ooo_dispatch_one(fetched, fetched->pc + 4, fetched->instruction2, fetched->new_pc, fetched->trace_id2)) {
+        set_pc(fetched->pc + 4);
+        if (pipeview != NULL) {
+            pipeview_note(fetched->trace_id2, PIPEVIEW_STALL, PIPEVIEW_WINDOW_FULL);
+        }
+        return;
+    }
+    // direct jumps are redirected here, as in the pipeline's decode
+    struct rob_entry* youngest = &core.rob[(core.rob_head + core.rob_count - 1) % core.rob_entries];
+    if (youngest->instruction.data.u.opcode == 0b1101111) {
+        uint64_t target = youngest->pc + jal_offset(youngest->instruction);
+        if (target != youngest->new_pc) {
+            set_pc(target);
+            youngest->new_pc = target;
+            decode_redirected = 1;
+        }
+    }
+}
+
+// reports where every instruction after fetch is to the pipeline trace
+void ooo_pipeview() {
+    const struct stage_reg_d* fetched = current_stage_d_register;
+    if (fetched->not_stalled) {
+        pipeview_stage(fetched->trace_id, "Dp");
+        if (fetched->dual) {
+            pipeview_stage(fetched->trace_id2, "Dp");
+        }
+    }
+    for (uint32_t i = 0; i < core.rob_count; i++) {
+        const struct rob_entry* entry = &core.rob[(core.rob_head + i) % core.rob_entries];
+        pipeview_stage(entry->trace_id, !entry->issued ? "Iq" : !entry->completed ? "M" : "C");
+    }
+}
@@ -0,0 +1,116 @@
+# ifndef OOO_CORE_H
+# define OOO_CORE_H
+
+#include <stdint.h>
+#include "riscv.h"
+
+// timing models, selected with the core_type option
+#define CORE_IN_ORDER 0
+#define CORE_OUT_OF_ORDER 1
+
+// Reorder buffer entry, allocated at dispatch and freed at commit in program order
+struct rob_entry {
+    uint64_t seq; // dispatch order, tells an entry apart from a later one reusing its slot
+    uint64_t pc;
+    uint64_t new_pc; // predicted next pc until the instruction executes, then the resolved one
+    uint64_t bp_history;
+    uint64_t path_history;
+    uint32_t ras_top;
+    uint64_t ras_value;
+    struct riscv_instruction instruction;
+    int16_t rd; // -1 if no register is written
+    uint64_t value;
+    int32_t load; // load queue slot, -1 if none
+    int64_t store; // store queue position, -1 if none
+    uint8_t completed;
+    uint8_t illegal; // reported when it commits, wrong-path garbage never is
+    uint8_t mispredicted; // resolved to a different new_pc than fetch predicted
+    uint8_t issued;
+    uint64_t trace_id; // pipeview id
+};
+
+// Issue queue entry; a source operand is captured when its producer completes
+struct iq_entry {
+    uint8_t valid;
+    uint32_t rob;
+    int32_t source[2]; // producing ROB entry, -1 once the value is known
+    uint64_t value[2];
+};
+
+struct load_queue_entry {
+    uint32_t rob;
+    uint64_t older_stores; // store queue position just past the youngest older store
+    uint64_t address;
+    uint8_t size;
+    uint8_t sign_extend;
+    uint8_t address_ready;
+    uint8_t issued; // sent to the D-cache or forwarded from a store
+    uint8_t faulted; // its page walk found no mapping, retried only at the head of the ROB
+    uint64_t physical_address; // once done, (uint64_t) -1 if forwarded
+};
+
+struct store_queue_entry {
+    uint32_t rob;
+    uint64_t pc; // the ROB entry is gone by the time a committed store is written
+    uint64_t address;
+    uint64_t value;
+    uint8_t size;
+    uint8_t address_ready;
+    uint8_t committed; // written to the D-cache in order once committed
+    uint8_t atomic; // an A-extension instruction, done at the head of the ROB instead of after commit
+    uint8_t operation; // its funct5
+};
+
+// the single D-cache access in progress; a load keeps its ROB seq so a squash can drop it
+struct ooo_memory_access {
+    uint8_t active;
+    uint8_t store;
+    uint8_t atomic;
+    uint8_t operation;
+    uint32_t rob;
+    uint64_t seq;
+    uint64_t pc;
+    uint64_t address;
+    uint64_t physical_address;
+    uint64_t value;
+    uint8_t size;
+    uint8_t sign_extend;
+    uint8_t was_stalled;
+    uint8_t stall_status;
+};
+
+struct ooo_core {
+    struct rob_entry* rob;
+    uint32_t rob_entries;
+    uint32_t rob_head;
+    uint32_t rob_count;
+    uint64_t seq;
+    struct iq_entry* iq;
+    uint32_t iq_entries;
+    struct load_queue_entry* load_queue;
+    uint32_t lsq_entries;
+    uint32_t load_head;
+    uint32_t load_count;
+    struct store_queue_entry* store_queue; // indexed by position % lsq_entries
+    uint64_t store_head;
+    uint64_t store_tail;
+    int32_t rename_table[32]; // youngest in-flight ROB entry writing each register, -1 if it is in the register file
+    uint32_t* wakeups; // ROB entries completed this cycle, broadcast to the issue queue at the end of execute
+    uint32_t wakeup_count;
+    uint32_t width;
+    struct ooo_memory_access access;
+    uint64_t refill_seq; // first instruction fetched after the last mispredict until it commits, 0 after that
+    uint8_t frontend_cause; // CPI_* cause of the last cycle decode had nothing to dispatch
+};
+
+void construct_ooo_core(uint32_t rob_entries, uint32_t iq_entries, uint32_t lsq_entries, uint32_t width);
+uint8_t ooo_fetch_blocked();
+void ooo_commit();
+void ooo_memory();
+void ooo_execute();
+void ooo_dispatch();
+uint8_t ooo_drained();
+uint64_t ooo_oldest_pc();
+void ooo_pipeview();
+
+#endif
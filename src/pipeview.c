@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pipeview.h"
+#include "riscv_sim_framework.h"
+#include "disassemble.h"
+#include "mem.h"
+
+#define PIPEVIEW_INITIAL_ENTRIES 64
+
+static const char* note_causes[] = {"", "I-cache miss", "I-TLB walk", "D-cache miss", "D-TLB walk", "operand not ready",
+                                    "branch mispredict", "memory port busy", "window full", "fetch redirected"};
+
+HART_LOCAL FILE* pipeview = NULL;
+// ids keep counting across traces, so one left in a pipeline register from an earlier trace is below pipeview_base
+static HART_LOCAL uint64_t pipeview_next_id = 1;
+static HART_LOCAL uint64_t pipeview_base;
+static HART_LOCAL uint64_t pipeview_cycle;
+static HART_LOCAL uint64_t pipeview_retire_count;
+// instructions in flight, in id order since ids are handed out in order and only ever removed
+static HART_LOCAL struct pipeview_entry* pipeview_entries = NULL;
+static HART_LOCAL uint64_t pipeview_count;
+static HART_LOCAL uint64_t pipeview_capacity;
+// a fetch waiting on the I-cache or I-TLB shows up in F from its first attempt
+static HART_LOCAL uint64_t pending_fetch_id;
+static HART_LOCAL uint64_t pending_fetch_pc;
+
+static struct pipeview_entry* pipeview_find(uint64_t id) {
+    if (id < pipeview_base) {
+        return NULL;
+    }
+    uint64_t low = 0;
+    uint64_t high = pipeview_count;
+    while (low < high) {
+        uint64_t middle = (low + high) / 2;
+        if (pipeview_entries[middle].id < id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < pipeview_count && pipeview_entries[low].id == id ? &pipeview_entries[low] : NULL;
+}
+
+static uint64_t pipeview_create(uint64_t pc) {
+    if (pipeview_count == pipeview_capacity) {
+        pipeview_capacity *= 2;
+        pipeview_entries = srealloc(pipeview_entries, pipeview_capacity * sizeof(struct pipeview_entry));
+    }
+    struct pipeview_entry* entry = &pipeview_entries[pipeview_count++];
+    memset(entry, 0, sizeof(struct pipeview_entry));
+    entry->id = pipeview_next_id++;
+    entry->stage = "F";
+    entry->seen = 1;
+    uint64_t id = entry->id - pipeview_base;
+    fprintf(pipeview, "I\t%lu\t%lu\t%u\nL\t%lu\t0\t%08lx: \nS\t%lu\t0\tF\n", (unsigned long) id, (unsigned long) id, hart_id,
+            (unsigned long) id, (unsigned long) pc, (unsigned long) id);
+    return entry->id;
+}
+
+// "pipeview" command - starts a new trace, anything already in flight is left out of it
+void pipeview_start(const char* file) {
+    pipeview_stop();
+    pipeview = fopen(file, "w");
+    if (pipeview == NULL) {
+        fprintf(stderr, "pipeview: cannot open %s\n", file);
+        return;
+    }
+    pipeview_base = pipeview_next_id;
+    pipeview_cycle = get_cycle_counter();
+    pipeview_retire_count = 0;
+    pipeview_count = 0;
+    pipeview_capacity = PIPEVIEW_INITIAL_ENTRIES;
+    pipeview_entries = smalloc(pipeview_capacity * sizeof(struct pipeview_entry));
+    pending_fetch_id = 0;
+    fprintf(pipeview, "Kanata\t0004\nC=\t%lu\n", (unsigned long) pipeview_cycle);
+}
+
+// instructions still in flight end the trace, as retired if they already have and flushed otherwise
+void pipeview_stop() {
+    if (pipeview == NULL) {
+        return;
+    }
+    for (uint64_t i = 0; i < pipeview_count; i++) {
+        pipeview_entries[i].seen = 0;
+    }
+    pipeview_end_cycle();
+    fclose(pipeview);
+    pipeview = NULL;
+    free(pipeview_entries);
+    pipeview_entries = NULL;
+}
+
+// called at the start of every cycle, before the core reports where its instructions are
+void pipeview_begin_cycle() {
+    uint64_t cycle = get_cycle_counter();
+    if (cycle != pipeview_cycle) {
+        fprintf(pipeview, "C\t%lu\n", (unsigned long) (cycle - pipeview_cycle));
+        pipeview_cycle = cycle;
+    }
+    for (uint64_t i = 0; i < pipeview_count; i++) {
+        pipeview_entries[i].seen = pipeview_entries[i].id == pending_fetch_id;
+    }
+}
+
+// whatever the core did not report has left it, retired if it got that far and flushed otherwise
+void pipeview_end_cycle() {
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < pipeview_count; i++) {
+        struct pipeview_entry* entry = &pipeview_entries[i];
+        if (entry->seen) {
+            pipeview_entries[kept++] = *entry;
+        } else if (entry->retired) {
+            fprintf(pipeview, "R\t%lu\t%lu\t0\n", (unsigned long) (entry->id - pipeview_base), (unsigned long) pipeview_retire_count++);
+        } else {
+            fprintf(pipeview, "R\t%lu\t0\t1\n", (unsigned long) (entry->id - pipeview_base));
+        }
+    }
+    pipeview_count = kept;
+}
+
+// a successful fetch, returns the id the instruction carries from now on
+uint64_t pipeview_fetch(uint64_t pc, uint32_t instruction) {
+    if (pending_fetch_id == 0 || pending_fetch_pc != pc) {
+        pipeview_fetch_stall(pc, PIPEVIEW_REDIRECTED); // drops a pending fetch of another pc
+        pending_fetch_id = pipeview_create(pc);
+    }
+    uint64_t id = pending_fetch_id;
+    pending_fetch_id = 0;
+    char text[64];
+    disassemble(instruction, pc, text, sizeof(text));
+    fprintf(pipeview, "L\t%lu\t0\t%s\n", (unsigned long) (id - pipeview_base), text);
+    return id;
+}
+
+// a fetch that has to wait, cause PIPEVIEW_REDIRECTED only drops a pending fetch of another pc
+void pipeview_fetch_stall(uint64_t pc, uint8_t cause) {
+    if (pending_fetch_id != 0 && pending_fetch_pc != pc) {
+        pipeview_note(pending_fetch_id, PIPEVIEW_FLUSH, PIPEVIEW_REDIRECTED);
+        pending_fetch_id = 0; // not reported from now on, so flushed at the start of the next cycle
+    }
+    if (cause == PIPEVIEW_REDIRECTED) {
+        return;
+    }
+    if (pending_fetch_id == 0) {
+        pending_fetch_id = pipeview_create(pc);
+        pending_fetch_pc = pc;
+    }
+    pipeview_note(pending_fetch_id, PIPEVIEW_STALL, cause);
+}
+
+void pipeview_stage(uint64_t id, const char* stage) {
+    struct pipeview_entry* entry = pipeview_find(id);
+    if (entry == NULL) {
+        return;
+    }
+    entry->seen = 1;
+    if (strcmp(entry->stage, stage) != 0) {
+        fprintf(pipeview, "E\t%lu\t0\t%s\nS\t%lu\t0\t%s\n", (unsigned long) (id - pipeview_base), entry->stage,
+                (unsigned long) (id - pipeview_base), stage);
+        entry->stage = stage;
+    }
+}
+
+// adds "cycle N: stalled on <cause>." or "... flushed by <cause>." to the detail text, a stall only when its cause changes
+void pipeview_note(uint64_t id, uint8_t kind, uint8_t cause) {
+    struct pipeview_entry* entry = pipeview_find(id);
+    uint16_t note = (uint16_t) ((kind << 8 | cause) + 1);
+    if (entry == NULL || (kind == PIPEVIEW_STALL && entry->note == note)) {
+        return;
+    }
+    entry->note = note;
+    fprintf(pipeview, "L\t%lu\t1\tcycle %lu: %s %s. \n", (unsigned long) (id - pipeview_base), (unsigned long) pipeview_cycle,
+            kind == PIPEVIEW_STALL ? "stalled on" : "flushed by", note_causes[cause]);
+}
+
+// a stalled memory access finished from its saved copy, it is fetched and executed again and that instance retires
+void pipeview_replayed(uint64_t id) {
+    if (pipeview_find(id) != NULL) {
+        fprintf(pipeview, "L\t%lu\t1\tcycle %lu: finished from the stalled copy, retires when fetched again. \n",
+                (unsigned long) (id - pipeview_base), (unsigned long) pipeview_cycle);
+    }
+}
+
+void pipeview_retired(uint64_t id) {
+    struct pipeview_entry* entry = pipeview_find(id);
+    if (entry != NULL) {
+        entry->retired = 1;
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef RISCVSIM_PIPEVIEW_H
+#define RISCVSIM_PIPEVIEW_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "hart.h"
+
+// Pipeline occupancy trace in the Kanata log format read by the Konata pipeline viewer. Every dynamic instruction gets
+// an id when it is fetched, which travels with it through the pipeline registers (or the ROB); at the start of each
+// cycle the core reports where each id is (pipeview_stage) and ids no longer anywhere are retired or flushed. Stalls
+// and flushes are added to the instruction's detail text, with the cycle they happened in.
+//
+// In-order stages are F, D, X, M and W. The out-of-order core has F, Dp (waiting to dispatch), Iq (in the issue
+// queue), X, M (load or atomic waiting on the D-cache) and C (completed, waiting to commit).
+
+// note kinds
+#define PIPEVIEW_STALL 0
+#define PIPEVIEW_FLUSH 1
+// note causes are CPI_* causes, or one of these
+#define PIPEVIEW_WINDOW_FULL 8 // the out-of-order core had no ROB, issue queue or load/store queue entry for it
+#define PIPEVIEW_REDIRECTED 9 // fetch went elsewhere while it was waiting on the I-cache or I-TLB
+
+struct pipeview_entry {
+    uint64_t id;
+    const char* stage;
+    uint16_t note; // kind and cause of the last note, to leave out a stall repeated every cycle
+    uint8_t seen;
+    uint8_t retired;
+};
+
+extern HART_LOCAL FILE* pipeview; // checked before every pipeview_* call, NULL unless a trace is being written
+
+void pipeview_start(const char* file);
+void pipeview_stop();
+void pipeview_begin_cycle();
+void pipeview_end_cycle();
+uint64_t pipeview_fetch(uint64_t pc, uint32_t instruction);
+void pipeview_fetch_stall(uint64_t pc, uint8_t cause);
+void pipeview_stage(uint64_t id, const char* stage);
+void pipeview_note(uint64_t id, uint8_t kind, uint8_t cause);
+void pipeview_replayed(uint64_t id);
+void pipeview_retired(uint64_t id);
+
+#endif //RISCVSIM_PIPEVIEW_H
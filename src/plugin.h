@@ -0,0 +1,48 @@
+#ifndef RISCVSIM_PLUGIN_H
+#define RISCVSIM_PLUGIN_H
+
+#include <stdint.h>
+
+// Instrumentation plugin interface. A plugin is a shared object loaded with "plugin <file> [args]" that exports
+//   int riscvsim_plugin_init(uint32_t version, const char* args, struct plugin_callbacks* callbacks);
+// which checks version against PLUGIN_API_VERSION, fills in the callbacks it wants (the rest stay NULL) and returns
+// 0, or anything else to refuse loading. This header is all a plugin needs; it never calls back into the simulator.
+//
+// Callbacks come from the thread of the hart they are about, so with harts above 1 they run concurrently and a plugin
+// keeps its state per hart (harts never exceed PLUGIN_MAX_HARTS) or locks it. Only the correct path is reported:
+// instructions that retire, their memory accesses and their branches, each once even when a stalled access is replayed.
+
+#define PLUGIN_API_VERSION 1
+#define PLUGIN_INIT_SYMBOL "riscvsim_plugin_init"
+#define PLUGIN_MAX_HARTS 16
+
+// memory access kinds
+#define PLUGIN_LOAD 0
+#define PLUGIN_STORE 1
+#define PLUGIN_ATOMIC 2
+
+// caches and TLBs an event comes from
+#define PLUGIN_ICACHE 0
+#define PLUGIN_DCACHE 1
+#define PLUGIN_ITLB 0
+#define PLUGIN_DTLB 1
+
+struct plugin_callbacks {
+    void* context; // handed back to every callback
+    // an instruction retired, in program order per hart
+    void (*retire) (void* context, uint32_t hart, uint64_t pc, uint32_t instruction);
+    // a load, store or atomic of a retired instruction was done by the D-cache
+    void (*memory) (void* context, uint32_t hart, uint64_t pc, uint64_t virtual_address, uint64_t physical_address, uint8_t size, uint8_t kind);
+    // a cache started a fill for the block at physical_address; includes fills for wrong-path fetches and loads
+    void (*cache_miss) (void* context, uint32_t hart, uint8_t cache, uint64_t physical_address);
+    // a TLB lookup missed and goes to the second-level TLB or the page table; wrong-path ones included
+    void (*tlb_miss) (void* context, uint32_t hart, uint8_t tlb, uint64_t virtual_address);
+    // a retired branch or jump, with where it went and whether fetch had predicted that
+    void (*branch) (void* context, uint32_t hart, uint64_t pc, uint64_t target, uint8_t taken, uint8_t mispredicted);
+    // the simulator is exiting, the last chance to report
+    void (*finish) (void* context);
+};
+
+typedef int (*plugin_init_function) (uint32_t version, const char* args, struct plugin_callbacks* callbacks);
+
+#endif //RISCVSIM_PLUGIN_H
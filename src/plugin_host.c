@@ -0,0 +1,104 @@
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plugin_host.h"
+#include "cache.h"
+#include "TLB.h"
+#include "hart.h"
+
+extern HART_LOCAL struct tlb dtlb;
+
+// Loaded plugins. They are only added between runs, from the command line, so the hart threads read this unlocked.
+uint8_t plugin_hooks = 0;
+static struct plugin_callbacks plugins[MAX_PLUGINS];
+static void* plugin_handles[MAX_PLUGINS];
+static uint32_t plugin_count = 0;
+
+static void plugin_unload_all() {
+    for (uint32_t i = 0; i < plugin_count; i++) {
+        if (plugins[i].finish != NULL) {
+            plugins[i].finish(plugins[i].context);
+        }
+        dlclose(plugin_handles[i]);
+    }
+    plugin_count = 0;
+    plugin_hooks = 0;
+}
+
+// "plugin" command - returns 0 if the plugin could not be loaded or refused to
+uint8_t plugin_load(const char* file, const char* args) {
+    if (plugin_count == MAX_PLUGINS) {
+        fprintf(stderr, "plugin: at most %d plugins can be loaded\n", MAX_PLUGINS);
+        return 0;
+    }
+    void* handle = dlopen(file, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "plugin: %s\n", dlerror());
+        return 0;
+    }
+    plugin_init_function init = (plugin_init_function) dlsym(handle, PLUGIN_INIT_SYMBOL);
+    if (init == NULL) {
+        fprintf(stderr, "plugin: %s has no %s\n", file, PLUGIN_INIT_SYMBOL);
+        dlclose(handle);
+        return 0;
+    }
+    struct plugin_callbacks* callbacks = &plugins[plugin_count];
+    memset(callbacks, 0, sizeof(struct plugin_callbacks));
+    if (init(PLUGIN_API_VERSION, args != NULL ? args : "", callbacks) != 0) {
+        fprintf(stderr, "plugin: %s refused to load\n", file);
+        dlclose(handle);
+        return 0;
+    }
+    if (plugin_count == 0) {
+        atexit(plugin_unload_all);
+    }
+    plugin_handles[plugin_count++] = handle;
+    plugin_hooks |= (uint8_t) ((callbacks->retire != NULL ? PLUGIN_HOOK_RETIRE : 0) | (callbacks->memory != NULL ? PLUGIN_HOOK_MEMORY : 0) |
+                               (callbacks->cache_miss != NULL ? PLUGIN_HOOK_CACHE_MISS : 0) | (callbacks->tlb_miss != NULL ? PLUGIN_HOOK_TLB_MISS : 0) |
+                               (callbacks->branch != NULL ? PLUGIN_HOOK_BRANCH : 0));
+    return 1;
+}
+
+void plugin_retire(uint64_t pc, uint32_t instruction) {
+    for (uint32_t i = 0; i < plugin_count; i++) {
+        if (plugins[i].retire != NULL) {
+            plugins[i].retire(plugins[i].context, hart_id, pc, instruction);
+        }
+    }
+}
+
+void plugin_memory(uint64_t pc, uint64_t virtual_address, uint64_t physical_address, uint8_t size, uint8_t kind) {
+    for (uint32_t i = 0; i < plugin_count; i++) {
+        if (plugins[i].memory != NULL) {
+            plugins[i].memory(plugins[i].context, hart_id, pc, virtual_address, physical_address, size, kind);
+        }
+    }
+}
+
+void plugin_cache_miss(const struct cache_table* cache, uint64_t physical_address) {
+    uint8_t which = (uint8_t) (cache->cache_type == CACHE_DATA ? PLUGIN_DCACHE : PLUGIN_ICACHE);
+    for (uint32_t i = 0; i < plugin_count; i++) {
+        if (plugins[i].cache_miss != NULL) {
+            plugins[i].cache_miss(plugins[i].context, hart_id, which, physical_address);
+        }
+    }
+}
+
+void plugin_tlb_miss(const struct tlb* tlb, uint64_t virtual_address) {
+    uint8_t which = (uint8_t) (tlb == &dtlb ? PLUGIN_DTLB : PLUGIN_ITLB);
+    for (uint32_t i = 0; i < plugin_count; i++) {
+        if (plugins[i].tlb_miss != NULL) {
+            plugins[i].tlb_miss(plugins[i].context, hart_id, which, virtual_address);
+        }
+    }
+}
+
+void plugin_branch(uint64_t pc, uint64_t target, uint8_t taken, uint8_t mispredicted) {
+    for (uint32_t i = 0; i < plugin_count; i++) {
+        if (plugins[i].branch != NULL) {
+            plugins[i].branch(plugins[i].context, hart_id, pc, target, taken, mispredicted);
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef RISCVSIM_PLUGIN_HOST_H
+#define RISCVSIM_PLUGIN_HOST_H
+
+#include <stdint.h>
+#include "plugin.h"
+
+struct cache_table;
+struct tlb;
+
+// bits of plugin_hooks, one per callback some loaded plugin has
+#define PLUGIN_HOOK_RETIRE 0x01
+#define PLUGIN_HOOK_MEMORY 0x02
+#define PLUGIN_HOOK_CACHE_MISS 0x04
+#define PLUGIN_HOOK_TLB_MISS 0x08
+#define PLUGIN_HOOK_BRANCH 0x10
+
+#define MAX_PLUGINS 8
+
+// tested before every plugin_* call, so with no plugin loaded an event costs a single branch
+extern uint8_t plugin_hooks;
+
+uint8_t plugin_load(const char* file, const char* args);
+void plugin_retire(uint64_t pc, uint32_t instruction);
+void plugin_memory(uint64_t pc, uint64_t virtual_address, uint64_t physical_address, uint8_t size, uint8_t kind);
+void plugin_cache_miss(const struct cache_table* cache, uint64_t physical_address);
+void plugin_tlb_miss(const struct tlb* tlb, uint64_t virtual_address);
+void plugin_branch(uint64_t pc, uint64_t target, uint8_t taken, uint8_t mispredicted);
+
+#endif //RISCVSIM_PLUGIN_HOST_H
@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plugin.h"
+
+// Example plugin: per hart instruction count, memory footprint in 16KB virtual pages and 64 byte blocks, cache and TLB
+// misses and branch accuracy, printed when the simulator exits. Load it with "plugin footprint.so [output file]".
+// Every hart only touches its own counters, so the callbacks need no locking.
+
+#define PAGE_BITS 14
+#define BLOCK_BITS 6
+#define ADDRESS_BITS 32
+
+struct hart_footprint {
+    uint64_t retired;
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t atomics;
+    uint64_t cache_misses[2];
+    uint64_t tlb_misses[2];
+    uint64_t branches;
+    uint64_t mispredicts;
+    uint8_t* pages; // bitmaps over the 32 bit virtual address space
+    uint8_t* blocks;
+};
+
+static struct hart_footprint harts[PLUGIN_MAX_HARTS];
+static char output[256];
+
+static uint64_t mark(uint8_t* bitmap, uint64_t index) {
+    uint8_t bit = (uint8_t) (1 << (index & 7));
+    uint64_t new = !(bitmap[index >> 3] & bit);
+    bitmap[index >> 3] |= bit;
+    return new;
+}
+
+static uint64_t count(const uint8_t* bitmap, uint64_t bits) {
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < bits >> 3; i++) {
+        total += (uint64_t) __builtin_popcount(bitmap[i]);
+    }
+    return total;
+}
+
+// the bitmaps are allocated by the hart's own first event, calloc leaves the untouched parts unbacked
+static struct hart_footprint* footprint_of(uint32_t hart) {
+    struct hart_footprint* footprint = &harts[hart];
+    if (footprint->pages == NULL) {
+        footprint->pages = calloc(1, 1ULL << (ADDRESS_BITS - PAGE_BITS - 3));
+        footprint->blocks = calloc(1, 1ULL << (ADDRESS_BITS - BLOCK_BITS - 3));
+        if (footprint->pages == NULL || footprint->blocks == NULL) {
+            fprintf(stderr, "footprint: out of memory\n");
+            exit(1);
+        }
+    }
+    return footprint;
+}
+
+static void retire(void* context, uint32_t hart, uint64_t pc, uint32_t instruction) {
+    struct hart_footprint* footprint = footprint_of(hart);
+    footprint->retired++;
+    mark(footprint->pages, (pc & 0xFFFFFFFF) >> PAGE_BITS);
+}
+
+static void memory(void* context, uint32_t hart, uint64_t pc, uint64_t virtual_address, uint64_t physical_address, uint8_t size, uint8_t kind) {
+    struct hart_footprint* footprint = footprint_of(hart);
+    if (kind == PLUGIN_LOAD) {
+        footprint->loads++;
+    } else if (kind == PLUGIN_STORE) {
+        footprint->stores++;
+    } else {
+        footprint->atomics++;
+    }
+    mark(footprint->pages, (virtual_address & 0xFFFFFFFF) >> PAGE_BITS);
+    mark(footprint->blocks, (virtual_address & 0xFFFFFFFF) >> BLOCK_BITS);
+}
+
+static void cache_miss(void* context, uint32_t hart, uint8_t cache, uint64_t physical_address) {
+    harts[hart].cache_misses[cache]++;
+}
+
+static void tlb_miss(void* context, uint32_t hart, uint8_t tlb, uint64_t virtual_address) {
+    harts[hart].tlb_misses[tlb]++;
+}
+
+static void branch(void* context, uint32_t hart, uint64_t pc, uint64_t target, uint8_t taken, uint8_t mispredicted) {
+    harts[hart].branches++;
+    harts[hart].mispredicts += mispredicted;
+}
+
+static void finish(void* context) {
+    FILE* out = output[0] ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "footprint: cannot open %s\n", output);
+        out = stdout;
+    }
+    for (uint32_t i = 0; i < PLUGIN_MAX_HARTS; i++) {
+        struct hart_footprint* footprint = &harts[i];
+        if (footprint->retired > 0) {
+            fprintf(out, "hart %u: %lu instructions, %lu loads, %lu stores, %lu atomics\n", i, (unsigned long) footprint->retired,
+                    (unsigned long) footprint->loads, (unsigned long) footprint->stores, (unsigned long) footprint->atomics);
+            fprintf(out, "hart %u: %lu pages touched, %lu data blocks touched\n", i, (unsigned long) count(footprint->pages, 1ULL << (ADDRESS_BITS - PAGE_BITS)),
+                    (unsigned long) count(footprint->blocks, 1ULL << (ADDRESS_BITS - BLOCK_BITS)));
+            fprintf(out, "hart %u: I-cache misses %lu, D-cache misses %lu, I-TLB misses %lu, D-TLB misses %lu\n", i,
+                    (unsigned long) footprint->cache_misses[PLUGIN_ICACHE], (unsigned long) footprint->cache_misses[PLUGIN_DCACHE],
+                    (unsigned long) footprint->tlb_misses[PLUGIN_ITLB], (unsigned long) footprint->tlb_misses[PLUGIN_DTLB]);
+            fprintf(out, "hart %u: %lu branches and jumps, %lu mispredicted\n", i, (unsigned long) footprint->branches, (unsigned long) footprint->mispredicts);
+        }
+        free(footprint->pages);
+        free(footprint->blocks);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+}
+
+int riscvsim_plugin_init(uint32_t version, const char* args, struct plugin_callbacks* callbacks) {
+    if (version != PLUGIN_API_VERSION) {
+        return 1;
+    }
+    strncpy(output, args, sizeof(output) - 1);
+    callbacks->retire = retire;
+    callbacks->memory = memory;
+    callbacks->cache_miss = cache_miss;
+    callbacks->tlb_miss = tlb_miss;
+    callbacks->branch = branch;
+    callbacks->finish = finish;
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "riscv_sim_framework.h"
+#include "cache.h"
+#include "TLB.h"
+#include "disassemble.h"
+#include "mem.h"
+
+extern HART_LOCAL struct cache_table instruction_cache;
+extern HART_LOCAL struct cache_table data_cache;
+extern HART_LOCAL struct tlb itlb;
+extern HART_LOCAL struct tlb dtlb;
+
+#define PROFILE_INITIAL_ENTRIES 1024
+
+HART_LOCAL uint8_t profiling = 0;
+// open addressing on the PC, doubled once half full
+static HART_LOCAL struct profile_entry* profile_table = NULL;
+static HART_LOCAL uint64_t profile_entries = 0;
+static HART_LOCAL uint64_t profile_used = 0;
+static HART_LOCAL uint64_t profile_cycles = 0;
+// miss counts already handed out; a fetch or memory access gets whatever they grew by since
+static HART_LOCAL uint64_t seen_icache_misses;
+static HART_LOCAL uint64_t seen_itlb_misses;
+static HART_LOCAL uint64_t seen_dcache_misses;
+static HART_LOCAL uint64_t seen_dtlb_misses;
+
+static uint64_t profile_slot(uint64_t pc) {
+    return (pc >> 2) * 0x9E3779B97F4A7C15ULL >> 20 & (profile_entries - 1);
+}
+
+static struct profile_entry* profile_find(uint64_t pc) {
+    uint64_t slot = profile_slot(pc);
+    while (profile_table[slot].used && profile_table[slot].pc != pc) {
+        slot = (slot + 1) & (profile_entries - 1);
+    }
+    struct profile_entry* entry = &profile_table[slot];
+    if (entry->used) {
+        return entry;
+    }
+    if ((profile_used + 1) * 2 > profile_entries) {
+        struct profile_entry* old_table = profile_table;
+        uint64_t old_entries = profile_entries;
+        profile_entries *= 2;
+        profile_table = scalloc(profile_entries * sizeof(struct profile_entry));
+        for (uint64_t i = 0; i < old_entries; i++) {
+            if (old_table[i].used) {
+                slot = profile_slot(old_table[i].pc);
+                while (profile_table[slot].used) {
+                    slot = (slot + 1) & (profile_entries - 1);
+                }
+                profile_table[slot] = old_table[i];
+            }
+        }
+        free(old_table);
+        return profile_find(pc);
+    }
+    entry->used = 1;
+    entry->pc = pc;
+    profile_used++;
+    return entry;
+}
+
+// "profile on" - drops the previous profile and starts a new one
+void profile_start() {
+    free(profile_table);
+    profile_entries = PROFILE_INITIAL_ENTRIES;
+    profile_table = scalloc(profile_entries * sizeof(struct profile_entry));
+    profile_used = 0;
+    profile_cycles = 0;
+    seen_icache_misses = instruction_cache.misses;
+    seen_itlb_misses = itlb.misses;
+    seen_dcache_misses = data_cache.misses;
+    seen_dtlb_misses = dtlb.misses;
+    profiling = 1;
+}
+
+void profile_stop() {
+    profiling = 0;
+}
+
+void profile_cycle(uint64_t pc) {
+    profile_find(pc)->cycles++;
+    profile_cycles++;
+}
+
+void profile_fetch(uint64_t pc) {
+    if (instruction_cache.misses == seen_icache_misses && itlb.misses == seen_itlb_misses) {
+        return;
+    }
+    struct profile_entry* entry = profile_find(pc);
+    entry->icache_misses += instruction_cache.misses - seen_icache_misses;
+    entry->tlb_misses += itlb.misses - seen_itlb_misses;
+    seen_icache_misses = instruction_cache.misses;
+    seen_itlb_misses = itlb.misses;
+}
+
+void profile_memory(uint64_t pc) {
+    if (data_cache.misses == seen_dcache_misses && dtlb.misses == seen_dtlb_misses) {
+        return;
+    }
+    struct profile_entry* entry = profile_find(pc);
+    entry->dcache_misses += data_cache.misses - seen_dcache_misses;
+    entry->tlb_misses += dtlb.misses - seen_dtlb_misses;
+    seen_dcache_misses = data_cache.misses;
+    seen_dtlb_misses = dtlb.misses;
+}
+
+void profile_mispredict(uint64_t pc) {
+    profile_find(pc)->mispredicts++;
+}
+
+static int compare_cycles(const void* a, const void* b) {
+    const struct profile_entry* x = a;
+    const struct profile_entry* y = b;
+    if (x->cycles != y->cycles) {
+        return x->cycles < y->cycles ? 1 : -1;
+    }
+    return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+// "profile report" - flat profile, most cycles first, limit 0 for every PC
+void profile_report(FILE* out, uint64_t limit) {
+    if (profile_table == NULL) {
+        fprintf(out, "No profile, start one with \"profile on\"\n");
+        return;
+    }
+    struct profile_entry* sorted = smalloc((profile_used ? profile_used : 1) * sizeof(struct profile_entry));
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < profile_entries; i++) {
+        if (profile_table[i].used) {
+            sorted[count++] = profile_table[i];
+        }
+    }
+    qsort(sorted, count, sizeof(struct profile_entry), compare_cycles);
+    if (limit == 0 || limit > count) {
+        limit = count;
+    }
+    fprintf(out, "%lu cycles over %lu PCs\n", (unsigned long) profile_cycles, (unsigned long) count);
+    fprintf(out, "%-18s %10s %7s %8s %8s %8s %8s  %s\n", "pc", "cycles", "%", "icache", "dcache", "tlb", "mispred", "instruction");
+    for (uint64_t i = 0; i < limit; i++) {
+        struct profile_entry* entry = &sorted[i];
+        uint32_t instruction = 0;
+        char text[64];
+        memory_read_direct(entry->pc, &instruction, 4);
+        disassemble(instruction, entry->pc, text, sizeof(text));
+        fprintf(out, "0x%016lx %10lu %6.2f%% %8lu %8lu %8lu %8lu  %s\n", (unsigned long) entry->pc, (unsigned long) entry->cycles,
+                profile_cycles ? 100.0 * (double) entry->cycles / (double) profile_cycles : 0.0, (unsigned long) entry->icache_misses,
+                (unsigned long) entry->dcache_misses, (unsigned long) entry->tlb_misses, (unsigned long) entry->mispredicts, text);
+    }
+    free(sorted);
+}
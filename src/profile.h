@@ -0,0 +1,30 @@
+#ifndef RISCVSIM_PROFILE_H
+#define RISCVSIM_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "hart.h"
+
+// Per-PC hotspot profile: every cycle goes to the oldest instruction in flight, and cache misses, TLB misses and
+// mispredicts to the instruction that caused them
+struct profile_entry {
+    uint64_t pc;
+    uint64_t cycles;
+    uint64_t icache_misses;
+    uint64_t dcache_misses;
+    uint64_t tlb_misses;
+    uint64_t mispredicts;
+    uint8_t used;
+};
+
+extern HART_LOCAL uint8_t profiling; // checked before every profile_* call, so a run without a profile pays nothing else
+
+void profile_start();
+void profile_stop();
+void profile_cycle(uint64_t pc);
+void profile_fetch(uint64_t pc);
+void profile_memory(uint64_t pc);
+void profile_mispredict(uint64_t pc);
+void profile_report(FILE* out, uint64_t limit);
+
+#endif //RISCVSIM_PROFILE_H
@@ -0,0 +1,204 @@
+// Branch trace replay driver: feeds a trace recorded with the simulator's "branchtrace" command to the predictors in
+// branch_predictor.c without running the pipeline, and reports mispredicts per kilo-instruction. Conditional branches
+// are scored on the direction predictor; jumps, calls, returns and other jalrs on the target fetch would predict from
+// the BTB, the return address stack and the indirect target predictor. Taken branches fill the BTB as in the pipeline.
+// A trace does not tell an indirect call from another jalr, so only jal calls push the return address stack.
+//
+// usage: bpreplay <trace> [-t type] [-b table_bits] [-h history_length] [-e btb_entries] [-w btb_ways]
+//                 [-r ras_entries] [-i itp_entries] [-p itp_path_length] [-s count]
+//   -t  predictor type (0 bimodal, 1 gshare, 2 tournament, 3 TAGE), all of them if not given
+//   -s  also list the count static branches and jumps with the most mispredicts
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../branch_predictor.h"
+#include "../mem.h"
+
+struct static_branch {
+    uint64_t pc;
+    uint64_t executions;
+    uint64_t taken;
+    uint64_t mispredicts;
+};
+
+struct static_branch* static_branches = NULL;
+uint64_t static_branch_slots = 0;
+
+// BTB, return address stack and indirect predictor sizes, the simulator's defaults unless given
+uint32_t btb_entries = 32;
+uint32_t btb_ways = 4;
+uint32_t ras_entries = 8;
+uint32_t itp_entries = 64;
+uint8_t itp_path_length = 4;
+
+// an instruction word of the record's type for predict_address: jal, jal ra, jalr x0 0(ra) or jalr x0 0(t1)
+uint32_t record_instruction(uint8_t type) {
+    switch (type) {
+        case BRANCH_CONDITIONAL:
+            return 0x00000063;
+        case BRANCH_JUMP:
+            return 0x0000006F;
+        case BRANCH_CALL:
+            return 0x000000EF;
+        case BRANCH_RETURN:
+            return 0x00008067;
+    }
+    return 0x00030067;
+}
+
+// open addressing on the branch address, sized to twice the records so it never fills
+struct static_branch* find_static_branch(uint64_t pc) {
+    uint64_t slot = (pc >> 2) * 0x9E3779B97F4A7C15ULL & (static_branch_slots - 1);
+    while (static_branches[slot].executions && static_branches[slot].pc != pc) {
+        slot = (slot + 1) & (static_branch_slots - 1);
+    }
+    static_branches[slot].pc = pc;
+    return &static_branches[slot];
+}
+
+int compare_mispredicts(const void* a, const void* b) {
+    uint64_t mispredicts_a = ((const struct static_branch*) a)->mispredicts;
+    uint64_t mispredicts_b = ((const struct static_branch*) b)->mispredicts;
+    return mispredicts_a < mispredicts_b ? 1 : mispredicts_a > mispredicts_b ? -1 : 0;
+}
+
+void replay(struct branch_trace_record* records, uint64_t num_records, uint8_t type, uint8_t table_bits, uint8_t history_length, uint64_t show_static) {
+    construct_branch_predictor(type, table_bits, history_length);
+    construct_btb(btb_entries, btb_ways);
+    construct_ras(ras_entries);
+    construct_indirect_predictor(itp_entries, itp_path_length);
+    memset(static_branches, 0, static_branch_slots * sizeof(struct static_branch));
+    uint64_t instructions = 0;
+    uint64_t branches = 0;
+    uint64_t mispredicts = 0;
+    uint64_t jumps = 0;
+    uint64_t jump_mispredicts = 0;
+    for (uint64_t i = 0; i < num_records; i++) {
+        instructions += records[i].instructions;
+        if (records[i].type == BRANCH_NONE) {
+            continue;
+        }
+        uint8_t conditional = records[i].type == BRANCH_CONDITIONAL;
+        uint32_t instruction = record_instruction(records[i].type);
+        uint64_t fetch_path_history = path_history;
+        uint8_t direction = conditional ? predict_direction(records[i].pc) : 0;
+        uint64_t predicted_target = predict_address(records[i].pc, instruction); // also pushes or pops the stack
+        uint8_t mispredicted;
+        if (conditional) {
+            mispredicted = direction != records[i].taken;
+            update_direction(records[i].pc, branch_history, records[i].taken);
+            branches++;
+            mispredicts += mispredicted;
+        } else {
+            mispredicted = predicted_target != records[i].target;
+            update_indirect(records[i].pc, instruction, fetch_path_history, records[i].target);
+            jumps++;
+            jump_mispredicts += mispredicted;
+        }
+        if (records[i].taken) {
+            update_entry(records[i].pc, records[i].target, conditional);
+        }
+        if (show_static) {
+            struct static_branch* branch = find_static_branch(records[i].pc);
+            branch->executions++;
+            branch->taken += records[i].taken;
+            branch->mispredicts += mispredicted;
+        }
+    }
+    printf("%-12s %12llu %12llu %12llu %10.3f %8.4f %12llu %12llu %10.3f %8.4f\n", direction_predictor_name(), (unsigned long long) instructions,
+           (unsigned long long) branches, (unsigned long long) mispredicts, instructions ? 1000.0 * mispredicts / instructions : 0.0,
+           branches ? (double) mispredicts / branches : 0.0, (unsigned long long) jumps, (unsigned long long) jump_mispredicts,
+           instructions ? 1000.0 * jump_mispredicts / instructions : 0.0, jumps ? (double) jump_mispredicts / jumps : 0.0);
+    if (!show_static) {
+        return;
+    }
+    qsort(static_branches, static_branch_slots, sizeof(struct static_branch), compare_mispredicts);
+    for (uint64_t i = 0; i < show_static && i < static_branch_slots && static_branches[i].executions; i++) {
+        printf("  pc 0x%08llx executions %10llu taken %10llu mispredicts %10llu MPKI %8.3f\n", (unsigned long long) static_branches[i].pc,
+               (unsigned long long) static_branches[i].executions, (unsigned long long) static_branches[i].taken,
+               (unsigned long long) static_branches[i].mispredicts, instructions ? 1000.0 * static_branches[i].mispredicts / instructions : 0.0);
+    }
+}
+
+int main(int argc, char** argv) {
+    int type = -1;
+    uint8_t table_bits = 10;
+    uint8_t history_length = 12;
+    uint64_t show_static = 0;
+    const char* file = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && i + 1 < argc) {
+            uint64_t value = strtoull(argv[i + 1], NULL, 0);
+            switch (argv[i][1]) {
+                case 't':
+                    type = (int) value;
+                    break;
+                case 'b':
+                    table_bits = (uint8_t) value;
+                    break;
+                case 'h':
+                    history_length = (uint8_t) value;
+                    break;
+                case 'e':
+                    btb_entries = (uint32_t) value;
+                    break;
+                case 'w':
+                    btb_ways = (uint32_t) value;
+                    break;
+                case 'r':
+                    ras_entries = (uint32_t) value;
+                    break;
+                case 'i':
+                    itp_entries = (uint32_t) value;
+                    break;
+                case 'p':
+                    itp_path_length = (uint8_t) value;
+                    break;
+                case 's':
+                    show_static = value;
+                    break;
+                default:
+                    file = NULL;
+                    i = argc;
+                    continue;
+            }
+            i++;
+        } else if (file == NULL) {
+            file = argv[i];
+        }
+    }
+    if (file == NULL) {
+        fprintf(stderr, "usage: bpreplay <trace> [-t type] [-b table_bits] [-h history_length] [-e btb_entries] [-w btb_ways] "
+                        "[-r ras_entries] [-i itp_entries] [-p itp_path_length] [-s count]\n");
+        return 1;
+    }
+    FILE* in = fopen(file, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "bpreplay: cannot open %s\n", file);
+        return 1;
+    }
+    fseek(in, 0, SEEK_END);
+    uint64_t num_records = (uint64_t) ftell(in) / sizeof(struct branch_trace_record);
+    fseek(in, 0, SEEK_SET);
+    struct branch_trace_record* records = smalloc(num_records * sizeof(struct branch_trace_record) + 1);
+    if (fread(records, sizeof(struct branch_trace_record), num_records, in) != num_records) {
+        fprintf(stderr, "bpreplay: short read from %s\n", file);
+        return 1;
+    }
+    fclose(in);
+    static_branch_slots = 2;
+    while (show_static && static_branch_slots < 2 * num_records) {
+        static_branch_slots <<= 1;
+    }
+    static_branches = scalloc(static_branch_slots * sizeof(struct static_branch));
+    printf("%-12s %12s %12s %12s %10s %8s %12s %12s %10s %8s\n", "predictor", "instructions", "branches", "mispredicts", "MPKI", "rate", "jumps",
+           "mispredicts", "MPKI", "rate");
+    for (uint8_t i = 0; i <= BP_TAGE; i++) {
+        if (type == -1 || type == i) {
+            replay(records, num_records, i, table_bits, history_length, show_static);
+        }
+    }
+    return 0;
+}
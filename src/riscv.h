@@ -47,4 +47,11 @@ struct __attribute__((packed)) riscv_instruction {
     } data;
 };
 
+// register fields an instruction really reads and writes (rs1, rs2 and rd sit in the same bits in every format)
+struct operand_usage {
+    uint8_t rs1 : 1;
+    uint8_t rs2 : 1;
+    uint8_t rd : 1;
+};
+
 #endif //RISCVSIM_RISCV_H
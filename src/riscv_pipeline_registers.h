@@ -29,44 +29,82 @@
 struct stage_reg_d {
     uint64_t    pc;
     uint64_t    new_pc;
+    uint64_t    bp_history; // global branch history at fetch
+    uint64_t    path_history; // indirect target path history at fetch
+    uint32_t    ras_top; // return address stack checkpoint from before this instruction
+    uint64_t    ras_value;
     uint32_t    instruction;
+    uint32_t    instruction2; // second slot when dual is set (issue_width 2)
+    uint8_t     dual;
     uint8_t     not_stalled;
     uint8_t     will_be_stalled;
     uint8_t     tlb_stall_status;
+    uint8_t     bubble; // CPI_* cause charged for an empty register (not_stalled clear)
+    uint64_t    trace_id; // pipeview ids of the instruction and the second slot, 0 when no trace is written
+    uint64_t    trace_id2;
 };
 
 struct stage_reg_x {
     uint64_t                    pc;
     uint64_t                    new_pc;
+    uint64_t                    bp_history;
+    uint64_t                    path_history;
+    uint32_t                    ras_top;
+    uint64_t                    ras_value;
     struct riscv_instruction    instruction;
     uint8_t                     not_stalled;
+    uint8_t                     bubble;
     uint64_t                    rs1_value;
     uint64_t                    rs2_value;
     int16_t                     rs1;
     int16_t                     rs2;
     int16_t                     rd;
+    uint8_t                     dual; // second slot at pc + 4, always an ALU instruction
+    struct riscv_instruction    instruction2;
+    uint64_t                    rs1_value2;
+    uint64_t                    rs2_value2;
+    int16_t                     rd2;
+    uint64_t                    trace_id;
+    uint64_t                    trace_id2;
 };
 
 struct stage_reg_m {
     uint64_t    address; // address of memory
     uint8_t     size; // size of operation
-    uint8_t     readWrite; // 3 for register write, 2 for memory read, 1 for memory write, 0 for nop
+    uint8_t     readWrite; // 4 for atomic read-modify-write, 3 for register write, 2 for memory read, 1 for memory write, 0 for nop
     uint8_t     signExtend; // 1 for doing sign extensions to 64-bit, 0 otherwise
     uint64_t    reg; // register to read into for reads, or write into for register writes
     uint64_t    value; // value to write
+    uint8_t     amo; // funct5 of an atomic
+    uint8_t     executed; // instructions execute ran (2 when dual), retired once memory access is done with them
+    uint8_t     bubble; // CPI_* cause charged while executed is 0
     uint8_t     tainted_executions;
     uint8_t     wasStalled;
     uint8_t     stallStatus;
     uint64_t    pc;
+    uint32_t    ras_top;
+    uint64_t    ras_value;
+    uint8_t     dual; // second slot register write in reg2/value2
+    uint64_t    reg2;
+    uint64_t    value2;
+    uint32_t    instruction; // as executed, and the second slot's when executed is 2
+    uint32_t    instruction2;
+    uint64_t    trace_id;
+    uint64_t    trace_id2;
 };
 
 struct stage_reg_w {
     uint64_t reg; // (uint64_t) -1 for nop
     uint64_t value;
     uint8_t  op; // 0 is nop, 1 is do writing
+    uint64_t reg2; // second slot write, after reg
+    uint64_t value2;
+    uint8_t  op2;
     uint8_t global_memory_stall;
     uint8_t tlb_stall_status;
     uint8_t tainted_executions;
     struct stage_reg_m memory_register;
+    uint64_t trace_id; // what memory access finished with, in writeback now
+    uint64_t trace_id2;
 };
 
@@ -5,8 +5,9 @@
 
 #pragma once
 #include "riscv_pipeline_registers.h"
+#include "hart.h"
 
-extern const struct stage_reg_d *   current_stage_d_register;
-extern const struct stage_reg_x *   current_stage_x_register;
-extern const struct stage_reg_m *   current_stage_m_register;
-extern const struct stage_reg_w *   current_stage_w_register;
\ No newline at end of file
+extern HART_LOCAL const struct stage_reg_d *   current_stage_d_register;
+extern HART_LOCAL const struct stage_reg_x *   current_stage_x_register;
+extern HART_LOCAL const struct stage_reg_m *   current_stage_m_register;
+extern HART_LOCAL const struct stage_reg_w *   current_stage_w_register;
\ No newline at end of file
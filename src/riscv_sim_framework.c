@@ -22,11 +22,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #ifdef  HAS_READLINE
 #include <readline/readline.h>
 #include <readline/history.h>
 #endif
 #include "riscv_sim_framework.h"
+#include "hart.h"
+#include "hostprofile.h"
 
 #define		MEMORY_MAX_SIZE		(32 * 1024 * 1024)		/* 32 MB maximum memory size */
 #define		MEMORY_PAGE_SIZE	(4096)					/* Memory size must be a multiple of page size */
@@ -49,20 +52,21 @@ typedef struct {
     uint64_t    n_bytes;
     uint64_t    end_cycle;
     int         op;
+    bool        is_read;    /* still true once a read is COMPLETED, for other stages polling it */
 } memory_pending_t;
 
 
 static uint8_t *    riscv_mem;
 static uint64_t     riscv_mem_size = 0ULL;
-static uint64_t     program_counter = 0ULL;
-static uint64_t     ptbr = 0ULL;
+static HART_LOCAL uint64_t program_counter = 0ULL;
+static HART_LOCAL uint64_t ptbr = 0ULL;
 static uint64_t     memory_read_latency = 0;
 static uint64_t     memory_write_latency = 0;
-static uint64_t     cycle_counter = 0ULL;
-static uint64_t     read_counter = 0ULL;
-static uint64_t     read_bytes = 0ULL;
-static uint64_t     write_counter = 0ULL;
-static uint64_t     write_bytes = 0ULL;
+static HART_LOCAL uint64_t cycle_counter = 0ULL;
+static HART_LOCAL uint64_t read_counter = 0ULL;
+static HART_LOCAL uint64_t read_bytes = 0ULL;
+static HART_LOCAL uint64_t write_counter = 0ULL;
+static HART_LOCAL uint64_t write_bytes = 0ULL;
 
 #define STAGE_F_BIT (1ULL << 0ULL)
 #define STAGE_D_BIT (1ULL << 1ULL)
@@ -70,10 +74,10 @@ static uint64_t     write_bytes = 0ULL;
 #define STAGE_M_BIT (1ULL << 3ULL)
 #define STAGE_W_BIT (1ULL << 4ULL)
 
-static memory_pending_t     memory_pending[MEMORY_MAX_PENDING];
+static HART_LOCAL memory_pending_t memory_pending[MEMORY_MAX_PENDING];
 
 
-static uint64_t             current_stage = 0ULL;
+static HART_LOCAL uint64_t current_stage = 0ULL;
 /******************************************************************************************
  *
  * memory_initialize
@@ -143,6 +147,13 @@ get_cycle_counter (void)
     return cycle_counter;
 }
 
+void
+get_memory_counters (uint64_t * reads, uint64_t * writes)
+{
+    *reads = read_counter;
+    *writes = write_counter;
+}
+
 /******************************************************************************************
  *
  * memory_load
@@ -173,20 +184,53 @@ bool memory_dump (void * region, uint64_t base, uint64_t size)
     return true;
 }
 
+/******************************************************************************************
+ *
+ * memory_read_direct
+ * memory_write_direct
+ *
+ * Access memory contents with no latency, port or stage checks, and without counting
+ * the access.  For models that track timing separately from the values they move
+ * (e.g. tag-only caches).
+ *
+ *****************************************************************************************/
+bool memory_read_direct (uint64_t address, void * value, uint64_t size_in_bytes)
+{
+    return memory_dump (value, address, size_in_bytes);
+}
+
+bool memory_write_direct (uint64_t address, const void * value, uint64_t size_in_bytes)
+{
+    return memory_load (value, address, size_in_bytes);
+}
+
 static bool
 memory_add_pending (uint64_t address, uint64_t size_in_bytes, int op)
 {
     memory_pending_t *      pnd = memory_pending;
+    memory_pending_t *      reclaim = NULL;
 
     for (int i = 0; i < MEMORY_MAX_PENDING; ++i, ++pnd) {
         if (pnd->op == MEMORY_OP_NONE) {
-            pnd->address = address;
-            pnd->n_bytes = size_in_bytes;
-            pnd->op = op;
-            pnd->end_cycle = cycle_counter;
-            pnd->end_cycle += (op == MEMORY_OP_WRITE) ? memory_write_latency : memory_read_latency;
-            return true;
+            reclaim = pnd;
+            break;
         }
+        /* Otherwise reuse the oldest access that finished a while ago but was abandoned by its stage
+           (e.g. a fetch redirected during an I-cache miss) */
+        if ((pnd->op == MEMORY_OP_READ || pnd->op == MEMORY_OP_WRITE) && pnd->end_cycle + 2 <= cycle_counter &&
+            (reclaim == NULL || pnd->end_cycle < reclaim->end_cycle)) {
+            reclaim = pnd;
+        }
+    }
+
+    if (reclaim != NULL) {
+        reclaim->address = address;
+        reclaim->n_bytes = size_in_bytes;
+        reclaim->op = op;
+        reclaim->is_read = op == MEMORY_OP_READ;
+        reclaim->end_cycle = cycle_counter;
+        reclaim->end_cycle += (op == MEMORY_OP_WRITE) ? memory_write_latency : memory_read_latency;
+        return true;
     }
 
     return false;
@@ -216,8 +260,8 @@ memory_add_pending (uint64_t address, uint64_t size_in_bytes, int op)
  *****************************************************************************************/
 
 #ifdef  SIM_NO_PIPELINE
-static uint32_t     memory_cycle_reads = 0;
-static uint32_t     memory_cycle_writes = 0;
+static HART_LOCAL uint32_t memory_cycle_reads = 0;
+static HART_LOCAL uint32_t memory_cycle_writes = 0;
 
 static void memory_reset_cycle ()
 {
@@ -228,10 +272,11 @@ static void memory_reset_cycle ()
 
 
 /* Memory accesses issued during which stages so far */
-static uint64_t             memory_accesses_issued = 0ULL;
+static HART_LOCAL uint64_t memory_accesses_issued = 0ULL;
 
+static
 bool
-memory_read (uint64_t address, void *value, uint64_t size_in_bytes)
+memory_read_internal (uint64_t address, void *value, uint64_t size_in_bytes)
 {
     if (size_in_bytes > MEMORY_MAX_READ_BYTES || __builtin_popcountll (size_in_bytes) != 1 ||
         address + size_in_bytes > riscv_mem_size || address % size_in_bytes != 0) {
@@ -266,6 +311,14 @@ memory_read (uint64_t address, void *value, uint64_t size_in_bytes)
     return false;
 }
 
+bool
+memory_read (uint64_t address, void *value, uint64_t size_in_bytes)
+{
+    bool done;
+    HOSTPROFILE_TIME (HOSTPROFILE_MEMORY_READ, done = memory_read_internal (address, value, size_in_bytes));
+    return done;
+}
+
 /******************************************************************************************
  *
  * memory_write
@@ -316,12 +369,14 @@ bool memory_write (uint64_t address, uint64_t value, uint64_t size_in_bytes)
     return false;
 }
 
-bool memory_status (uint64_t address, void * value)
+static
+bool
+memory_status_internal (uint64_t address, void * value)
 {
     for (int i = 0; i < MEMORY_MAX_PENDING; ++i) {
-        if (memory_pending[i].address == address) {
+        if (memory_pending[i].op != MEMORY_OP_NONE && memory_pending[i].address == address) {
             if (memory_pending[i].end_cycle <= cycle_counter) {
-                if (memory_pending[i].op == MEMORY_OP_READ) {
+                if (memory_pending[i].is_read) {
                     memory_dump (value, address, memory_pending[i].n_bytes);
                 }
                 memory_pending[i].op = MEMORY_OP_COMPLETED;
@@ -335,6 +390,26 @@ bool memory_status (uint64_t address, void * value)
     return false;
 }
 
+bool memory_status (uint64_t address, void * value)
+{
+    bool done;
+    HOSTPROFILE_TIME (HOSTPROFILE_MEMORY_STATUS, done = memory_status_internal (address, value));
+    return done;
+}
+
+/******************************************************************************************
+ *
+ * memory_port_available
+ *
+ * Returns true if a memory access issued now would be accepted, i.e. the current stage
+ * may access memory and hasn't done so yet this cycle.
+ *
+ *****************************************************************************************/
+bool memory_port_available (void)
+{
+    return (current_stage & (STAGE_F_BIT | STAGE_M_BIT)) && !(memory_accesses_issued & current_stage);
+}
+
 static void
 memory_retire_completed (void)
 {
@@ -359,9 +434,15 @@ memory_retire_completed (void)
 
 #define RISCV_NUM_REGISTERS         32
 
-static uint64_t     register_file[RISCV_NUM_REGISTERS];
-static uint32_t     register_cycle_reads = 0;
-static uint32_t     register_cycle_writes = 0;
+static HART_LOCAL uint64_t register_file[RISCV_NUM_REGISTERS];
+static HART_LOCAL uint32_t register_cycle_reads = 0;
+static HART_LOCAL uint32_t register_cycle_writes = 0;
+static HART_LOCAL uint32_t register_ports = 1;     /* register_read and register_write calls allowed per cycle */
+
+void set_register_ports (uint32_t ports)
+{
+    register_ports = ports;
+}
 
 static inline
 uint64_t register_read_one (uint64_t reg)
@@ -374,9 +455,10 @@ void register_read (uint64_t register_a, uint64_t register_b, uint64_t * value_a
 {
     *value_a = *value_b = 0ULL;
 
-    if (register_cycle_reads > 1) {
+    if (register_cycle_reads >= register_ports) {
         return;
     }
+    register_cycle_reads++;
     *value_a = register_read_one (register_a);
     *value_b = register_read_one (register_b);
 
@@ -384,9 +466,10 @@ void register_read (uint64_t register_a, uint64_t register_b, uint64_t * value_a
 
 void register_write (uint64_t register_d, uint64_t value_d)
 {
-    if (register_cycle_writes > 1) {
+    if (register_cycle_writes >= register_ports) {
         return;
     }
+    register_cycle_writes++;
     register_d %= RISCV_NUM_REGISTERS;
     register_file[register_d] = value_d;
 }
@@ -418,6 +501,7 @@ static void register_reset_cycle ()
  * setpc    <program_counter>
  * getpc    [/x]
  * run      <steps>
+ * hart     [<hart>]
  *
  * File format defaults to direct binary.  If you want to read or write hex format,
  * append "/x" to the command with a space after it (e.g., load /x, read /x).  Addresses
@@ -433,49 +517,58 @@ static char         cmdsep[] = " \t\n\r";
 static uint64_t     memory_size = 8 * 1024 * 1024;
 static const char * prog_name;
 
+/* 0 while an out-of-order core still has instructions in flight, see riscv_virtualizer.c */
+extern uint8_t core_drained (void);
+
 /*
  * The pipeline registers are defined even if no pipelining is needed.
  * This is done so we don't get undefined function and data structure
  * errors.
  */
-struct stage_reg_d cur_d_reg;
-struct stage_reg_x cur_x_reg;
-struct stage_reg_m cur_m_reg;
-struct stage_reg_w cur_w_reg;
+HART_LOCAL struct stage_reg_d cur_d_reg;
+HART_LOCAL struct stage_reg_x cur_x_reg;
+HART_LOCAL struct stage_reg_m cur_m_reg;
+HART_LOCAL struct stage_reg_w cur_w_reg;
 
-struct stage_reg_d * current_stage_d_register = &cur_d_reg;
-struct stage_reg_x * current_stage_x_register = &cur_x_reg;
-struct stage_reg_m * current_stage_m_register = &cur_m_reg;
-struct stage_reg_w * current_stage_w_register = &cur_w_reg;
+/* Pointed at this hart's registers by hart_state_initialize, the address of a thread-local isn't a constant */
+HART_LOCAL struct stage_reg_d * current_stage_d_register;
+HART_LOCAL struct stage_reg_x * current_stage_x_register;
+HART_LOCAL struct stage_reg_m * current_stage_m_register;
+HART_LOCAL struct stage_reg_w * current_stage_w_register;
+
+HART_LOCAL uint32_t hart_id = 0;
 
 
 #ifndef SIM_NO_PIPELINE
 static
-void
+uint64_t
 simulator_execute_instructions (uint64_t n_steps)
 {
     uint32_t            inst;
-    struct stage_reg_d  new_d_reg;
-    struct stage_reg_x  new_x_reg;
-    struct stage_reg_m  new_m_reg;
-    struct stage_reg_w  new_w_reg;
-
-    for (uint64_t i = 0; i < n_steps; ++i) {
+    uint64_t            i;
+    /* Static so fields a stage leaves untouched carry over between run commands like between cycles */
+    static HART_LOCAL struct stage_reg_d  new_d_reg;
+    static HART_LOCAL struct stage_reg_x  new_x_reg;
+    static HART_LOCAL struct stage_reg_m  new_m_reg;
+    static HART_LOCAL struct stage_reg_w  new_w_reg;
+
+    for (i = 0; i < n_steps; ++i) {
+        uint64_t cycle_start = hostprofiling ? host_timestamp () : 0;
         memory_dump (&inst, get_pc_internal(), sizeof (inst));
-        if (inst == RISCV_INSTR_EBREAK) {
+        if (inst == RISCV_INSTR_EBREAK && core_drained ()) {
             break;
         }
         register_reset_cycle ();
         current_stage = STAGE_W_BIT;
-        stage_writeback ();
+        HOSTPROFILE_TIME (HOSTPROFILE_WRITEBACK, stage_writeback ());
         current_stage = STAGE_M_BIT;
-        stage_memory (&new_w_reg);
+        HOSTPROFILE_TIME (HOSTPROFILE_MEMORY, stage_memory (&new_w_reg));
         current_stage = STAGE_X_BIT;
-        stage_execute (&new_m_reg);
+        HOSTPROFILE_TIME (HOSTPROFILE_EXECUTE, stage_execute (&new_m_reg));
         current_stage = STAGE_D_BIT;
-        stage_decode (&new_x_reg);
+        HOSTPROFILE_TIME (HOSTPROFILE_DECODE, stage_decode (&new_x_reg));
         current_stage = STAGE_F_BIT;
-        stage_fetch (&new_d_reg);
+        HOSTPROFILE_TIME (HOSTPROFILE_FETCH, stage_fetch (&new_d_reg));
         /* Copy newly-written registers to current registers */
         memcpy (&cur_d_reg, &new_d_reg, sizeof (cur_d_reg));
         memcpy (&cur_x_reg, &new_x_reg, sizeof (cur_x_reg));
@@ -484,18 +577,23 @@ simulator_execute_instructions (uint64_t n_steps)
         /* Retire completed memory accesses */
         cycle_counter += 1;
         memory_retire_completed ();
+        if (hostprofiling) {
+            hostprofile_add (HOSTPROFILE_CYCLE, cycle_start);
+        }
     }
+    return i;
 }
 #else
 
 static
-void
+uint64_t
 simulator_execute_instructions (uint64_t n_steps)
 {
     uint64_t    new_pc;
     uint32_t    inst;
+    uint64_t    i;
 
-    for (uint64_t i = 0; i < n_steps; ++i) {
+    for (i = 0; i < n_steps; ++i) {
         memory_dump (&inst, get_pc_internal (), sizeof (inst));
         if (inst == RISCV_INSTR_EBREAK) {
             break;
@@ -505,6 +603,7 @@ simulator_execute_instructions (uint64_t n_steps)
         execute_single_instruction (get_pc_internal (), &new_pc);
         set_pc_internal (new_pc);
     }
+    return i;
 }
 
 #endif
@@ -592,7 +691,7 @@ load_data_from_file (const char *filename, bool is_hex, uint64_t addr)
         return false;
     } else {
         ssize_t x = 0;
-        size_t total = offset;
+        size_t total = 0;
         do {
             x = fread(buf, 1, 4096, fp);
             if (x > 0) {
@@ -674,6 +773,196 @@ initialize_state (void)
     write_bytes = 0ULL;
 }
 
+static
+void
+hart_state_initialize (void)
+{
+    current_stage_d_register = &cur_d_reg;
+    current_stage_x_register = &cur_x_reg;
+    current_stage_m_register = &cur_m_reg;
+    current_stage_w_register = &cur_w_reg;
+    initialize_state ();
+}
+
+/******************************************************************************************
+ *
+ * Harts
+ *
+ * With the harts option above 1, every hart runs on its own host thread, with its own copy
+ * of everything marked HART_LOCAL (PC, registers, pipeline registers, memory ports, and the
+ * caches, TLBs and predictors of the pipeline model).  Memory is shared.  Hart 0 is the
+ * main thread.  Commands go to the hart picked with "hart <n>", except run, which advances
+ * every hart in quanta of "quantum" cycles with a barrier between quanta, until all of
+ * them reach an EBREAK or the steps run out.
+ *
+ *****************************************************************************************/
+
+typedef struct {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    char            line[SIM_MAX_LINE];
+    bool            pending;    /* line posted, cleared by the hart once it has executed it */
+} hart_thread_t;
+
+extern uint64_t config_get (const char * name);
+
+static uint32_t             num_harts = 0;          /* 0 until the hart threads are started */
+static uint32_t             selected_hart = 0;
+static hart_thread_t        hart_threads[MAX_HARTS];
+static pthread_barrier_t    quantum_barrier;
+static bool                 hart_halted[MAX_HARTS];
+static bool                 all_harts_halted;
+
+static bool execute_line (const char * l);
+
+static
+void *
+hart_thread (void * arg)
+{
+    hart_thread_t * t = arg;
+
+    hart_id = (uint32_t)(t - hart_threads);
+    hart_state_initialize ();
+    pthread_mutex_lock (&t->lock);
+    while (1) {
+        while (!t->pending) {
+            pthread_cond_wait (&t->cond, &t->lock);
+        }
+        pthread_mutex_unlock (&t->lock);
+        execute_line (t->line);
+        pthread_mutex_lock (&t->lock);
+        t->pending = false;
+        pthread_cond_broadcast (&t->cond);
+    }
+    return NULL;
+}
+
+static
+void
+harts_start (void)
+{
+    uint64_t    harts = config_get ("harts");
+
+    if (num_harts != 0) {
+        return;
+    }
+    if (harts < 1 || harts > MAX_HARTS) {
+        fprintf (stderr, "harts must be between 1-%d, not %llu\n", MAX_HARTS, (ull)harts);
+        exit (1);
+    }
+    num_harts = (uint32_t)harts;
+    if (num_harts == 1) {
+        return;
+    }
+    pthread_barrier_init (&quantum_barrier, NULL, num_harts);
+    for (uint32_t i = 1; i < num_harts; ++i) {
+        pthread_mutex_init (&hart_threads[i].lock, NULL);
+        pthread_cond_init (&hart_threads[i].cond, NULL);
+        pthread_create (&hart_threads[i].thread, NULL, hart_thread, &hart_threads[i]);
+    }
+}
+
+static
+void
+hart_post (uint32_t hart, const char * l)
+{
+    hart_thread_t * t = &hart_threads[hart];
+
+    pthread_mutex_lock (&t->lock);
+    strncpy (t->line, l, SIM_MAX_LINE-1);
+    t->line[SIM_MAX_LINE-1] = '\0';
+    t->pending = true;
+    pthread_cond_broadcast (&t->cond);
+    pthread_mutex_unlock (&t->lock);
+}
+
+static
+void
+hart_wait (uint32_t hart)
+{
+    hart_thread_t * t = &hart_threads[hart];
+
+    pthread_mutex_lock (&t->lock);
+    while (t->pending) {
+        pthread_cond_wait (&t->cond, &t->lock);
+    }
+    pthread_mutex_unlock (&t->lock);
+}
+
+/* Runs this hart for n_steps cycles in step with the others */
+static
+void
+hart_run (uint64_t n_steps)
+{
+    uint64_t    quantum = config_get ("quantum");
+    uint64_t    steps;
+    bool        halted = false;
+
+    if (quantum == 0) {
+        quantum = 1;
+    }
+    for (uint64_t done = 0; done < n_steps; done += quantum) {
+        steps = n_steps - done < quantum ? n_steps - done : quantum;
+        if (!halted) {
+            halted = simulator_execute_instructions (steps) < steps;
+        }
+        hart_halted[hart_id] = halted;
+        /* One hart decides whether everyone is done while the others wait, so all of them leave the loop together */
+        if (pthread_barrier_wait (&quantum_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+            all_harts_halted = true;
+            for (uint32_t i = 0; i < num_harts; ++i) {
+                all_harts_halted = all_harts_halted && hart_halted[i];
+            }
+        }
+        pthread_barrier_wait (&quantum_barrier);
+        if (all_harts_halted) {
+            break;
+        }
+    }
+}
+
+static
+void
+simulator_run (uint64_t n_steps)
+{
+    char    l[64];
+
+    harts_start ();
+    if (num_harts == 1) {
+        simulator_execute_instructions (n_steps);
+        return;
+    }
+    if (hart_id != 0) {
+        hart_run (n_steps);
+        return;
+    }
+    snprintf (l, sizeof (l), "run %llu", (ull)n_steps);
+    for (uint32_t i = 1; i < num_harts; ++i) {
+        hart_post (i, l);
+    }
+    hart_run (n_steps);
+    for (uint32_t i = 1; i < num_harts; ++i) {
+        hart_wait (i);
+    }
+}
+
+/* Hands a command to the selected hart; run, hart and exit are always done by the main thread */
+static
+bool
+dispatch_line (const char * l)
+{
+    char    cmd[16];
+
+    if (selected_hart == 0 || sscanf (l, "%15s", cmd) != 1 ||
+        !strcasecmp ("run", cmd) || !strcasecmp ("hart", cmd) || !strcasecmp ("exit", cmd)) {
+        return execute_line (l);
+    }
+    hart_post (selected_hart, l);
+    hart_wait (selected_hart);
+    return true;
+}
+
 static
 bool
 check_for_hex (const char *sep, char **ctx, char **token)
@@ -688,6 +977,30 @@ check_for_hex (const char *sep, char **ctx, char **token)
 
 const char* abi_regs[] = {"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
 
+/* Runtime options of the pipeline model, see config.c */
+extern uint8_t config_set (const char * name, uint64_t value);
+extern void config_print (FILE * out);
+/* TLB invalidation, see riscv_virtualizer.c */
+extern void flush_tlbs (int32_t asid, int64_t virtual_address);
+/* branch trace recording, see riscv_virtualizer.c */
+extern void set_branch_trace (const char * file);
+/* pipeline occupancy trace for the Konata viewer, see pipeview.c */
+extern void pipeview_start (const char * file);
+extern void pipeview_stop (void);
+/* D-cache coherence traffic of the hart, see riscv_virtualizer.c */
+extern void print_coherence_stats (void);
+/* CPI stack of the hart, see riscv_virtualizer.c */
+extern void print_cpi_stack (void);
+/* instrumentation plugins, see plugin_host.c */
+extern uint8_t plugin_load (const char * file, const char * args);
+/* counter time series, see interval_stats.c */
+extern void interval_stats_start (const char * file, uint64_t period, uint8_t unit, uint8_t format);
+extern void interval_stats_stop (void);
+/* per-PC hotspot profile, see profile.c */
+extern void profile_start (void);
+extern void profile_stop (void);
+extern void profile_report (FILE * out, uint64_t limit);
+
 /*
  * Need to rewrite this using flex and bison.  That'll happen soon....
  */
@@ -809,7 +1122,21 @@ execute_line (const char * l)
                 fprintf (stderr, "run: steps must be between 1-100000000, not %llu\n", (ull)n_steps);
                 break;
             }
-            simulator_execute_instructions (n_steps);
+            simulator_run (n_steps);
+        } else if (!strcasecmp ("hart", cmd)) {
+            harts_start ();
+            token = strtok_r (NULL, cmdsep, &ctx);
+            if (token == NULL) {
+                printf ("Hart: %u of %u\n", selected_hart, num_harts);
+                break;
+            }
+            value = strtoul (token, NULL, 0);
+            if (value >= num_harts) {
+                fprintf (stderr, "hart: no hart %llu, there are %u (set with config harts before the first run)\n",
+                         (ull)value, num_harts);
+                break;
+            }
+            selected_hart = (uint32_t)value;
         } else if (!strcasecmp ("setpc", cmd)) {
             token = strtok_r (NULL, cmdsep, &ctx);
             if (token == NULL) {
@@ -830,15 +1157,16 @@ execute_line (const char * l)
         } else if (!strcasecmp ("setptbr", cmd)) {
             token = strtok_r (NULL, cmdsep, &ctx);
             if (token == NULL) {
-                fprintf (stderr, "Usage: setptbr <page table base register>\n");
+                fprintf (stderr, "Usage: setptbr <page table base register, ASID in bits [47:32]>\n");
                 break;
             }
             value = strtoul (token, NULL, 0);
-            if (value > memory_size) {
+            /* bits [47:32] hold the address-space identifier, the root is in bits [31:0] */
+            if ((value & 0xFFFFFFFFULL) > memory_size) {
                 fprintf (stderr, "setptbr: page table base register (%llx) must be within memory (%llx)\n",
                          (ull)value, (ull)memory_size);
             }
-            if (value % MEMORY_PAGE_SIZE != 0) {
+            if ((value & 0xFFFFFFFFULL) % MEMORY_PAGE_SIZE != 0) {
                 fprintf (stderr, "setptbr: page table base register (%llx) must point to a page-aligned address\n",
                          (ull)value);
                 break;
@@ -847,6 +1175,138 @@ execute_line (const char * l)
         } else if (!strcasecmp ("initialize", cmd)) {
             printf ("Setting state registers, counters, and PC to 0!\n");
             initialize_state ();
+        } else if (!strcasecmp ("config", cmd)) {
+            token = strtok_r (NULL, cmdsep, &ctx);
+            if (token == NULL) {
+                config_print (stdout);
+                break;
+            }
+            cmd = token;
+            token = strtok_r (NULL, cmdsep, &ctx);
+            if (token == NULL) {
+                fprintf (stderr, "Usage: config [<option> <value>]\n");
+                break;
+            }
+            config_set (cmd, strtoull (token, NULL, 0));
+        } else if (!strcasecmp ("tlbflush", cmd)) {
+            int32_t asid = -1;
+            int64_t virtual_address = -1;
+            bool usage = false;
+            while ((token = strtok_r (NULL, cmdsep, &ctx)) != NULL) {
+                cmd = token;
+                token = strtok_r (NULL, cmdsep, &ctx);
+                if (token == NULL) {
+                    usage = true;
+                } else if (!strcasecmp ("asid", cmd)) {
+                    asid = (int32_t) (strtoul (token, NULL, 0) & 0xFFFF);
+                } else if (!strcasecmp ("va", cmd)) {
+                    virtual_address = (int64_t) (strtoull (token, NULL, 0) & 0xFFFFFFFFULL);
+                } else {
+                    usage = true;
+                }
+            }
+            if (usage) {
+                fprintf (stderr, "Usage: tlbflush [asid <asid>] [va <virtual address>]\n");
+                break;
+            }
+            flush_tlbs (asid, virtual_address);
+        } else if (!strcasecmp ("branchtrace", cmd)) {
+            token = strtok_r (NULL, cmdsep, &ctx);
+            if (token == NULL) {
+                fprintf (stderr, "Usage: branchtrace <file>|off\n");
+                break;
+            }
+            set_branch_trace (strcasecmp ("off", token) ? token : NULL);
+        } else if (!strcasecmp ("pipeview", cmd)) {
+            token = strtok_r (NULL, cmdsep, &ctx);
+            if (token == NULL) {
+                fprintf (stderr, "Usage: pipeview <file>|off\n");
+                break;
+            }
+            if (strcasecmp ("off", token)) {
+                pipeview_start (token);
+            } else {
+                pipeview_stop ();
+            }
+        } else if (!strcasecmp ("profile", cmd)) {
+            token = strtok_r (NULL, cmdsep, &ctx);
+            if (token == NULL) {
+                fprintf (stderr, "Usage: profile on|off|report [<n> [<file>]]\n");
+                break;
+            }
+            if (!strcasecmp ("on", token)) {
+                profile_start ();
+            } else if (!strcasecmp ("off", token)) {
+                profile_stop ();
+            } else if (!strcasecmp ("report", token)) {
+                uint64_t limit = 20;
+                FILE * out = stdout;
+                if ((token = strtok_r (NULL, cmdsep, &ctx)) != NULL) {
+                    limit = strtoull (token, NULL, 0);
+                    if ((token = strtok_r (NULL, cmdsep, &ctx)) != NULL && (out = fopen (token, "w")) == NULL) {
+                        fprintf (stderr, "profile: cannot open %s\n", token);
+                        break;
+                    }
+                }
+                profile_report (out, limit);
+                if (out != stdout) {
+                    fclose (out);
+                }
+            } else {
+                fprintf (stderr, "Usage: profile on|off|report [<n> [<file>]]\n");
+                break;
+            }
+        } else if (!strcasecmp ("hostprofile", cmd)) {
+            token = strtok_r (NULL, cmdsep, &ctx);
+            if (token != NULL && !strcasecmp ("on", token)) {
+                hostprofile_start ();
+            } else if (token != NULL && !strcasecmp ("off", token)) {
+                hostprofile_stop ();
+            } else if (token != NULL && !strcasecmp ("report", token)) {
+                hostprofile_report (stdout);
+            } else {
+                fprintf (stderr, "Usage: hostprofile on|off|report\n");
+                break;
+            }
+        } else if (!strcasecmp ("intervalstats", cmd)) {
+            const char * file = strtok_r (NULL, cmdsep, &ctx);
+            uint8_t unit = 0;       /* INTERVAL_CYCLES */
+            uint8_t format = 0;     /* INTERVAL_CSV */
+            bool usage = file == NULL;
+            if (!usage && !strcasecmp ("off", file)) {
+                interval_stats_stop ();
+                break;
+            }
+            token = usage ? NULL : strtok_r (NULL, cmdsep, &ctx);
+            value = token == NULL ? 0 : strtoull (token, NULL, 0);
+            while (!usage && (token = strtok_r (NULL, cmdsep, &ctx)) != NULL) {
+                if (!strcasecmp ("cycles", token)) {
+                    unit = 0;
+                } else if (!strcasecmp ("instructions", token)) {
+                    unit = 1;
+                } else if (!strcasecmp ("csv", token)) {
+                    format = 0;
+                } else if (!strcasecmp ("binary", token)) {
+                    format = 1;
+                } else {
+                    usage = true;
+                }
+            }
+            if (usage || value == 0) {
+                fprintf (stderr, "Usage: intervalstats <file> <period> [cycles|instructions] [csv|binary] | intervalstats off\n");
+                break;
+            }
+            interval_stats_start (file, value, unit, format);
+        } else if (!strcasecmp ("plugin", cmd)) {
+            token = strtok_r (NULL, cmdsep, &ctx);
+            if (token == NULL) {
+                fprintf (stderr, "Usage: plugin <shared object> [arguments]\n");
+                break;
+            }
+            /* the rest of the line goes to the plugin as it is */
+            char * args = ctx + strspn (ctx, " \t");
+            args[strcspn (args, "\r\n")] = '\0';
+            plugin_load (token, args);
         } else if (!strcasecmp ("getpc", cmd)) {
             printf ("PC: 0x%llx\n", (ull)get_pc ());
         } else if (!strcasecmp ("getcycles", cmd)) {
@@ -856,6 +1316,10 @@ execute_line (const char * l)
             printf ("Read bytes: %llu\n", (ull)read_bytes);
             printf ("Write operations: %llu\n", (ull)write_counter);
             printf ("Write bytes: %llu\n", (ull)write_bytes);
+        } else if (!strcasecmp ("coherencestats", cmd)) {
+            print_coherence_stats ();
+        } else if (!strcasecmp ("cpistack", cmd)) {
+            print_cpi_stack ();
         } else if (!strcasecmp ("exit", cmd)) {
             fflush (stdout);
             return false;
@@ -940,7 +1404,7 @@ main (int argc, char * const * argv)
     }
 
     memory_initialize (memory_size);
-    initialize_state ();
+    hart_state_initialize ();
 
 
     if (run_unit_tests) {
@@ -964,7 +1428,7 @@ main (int argc, char * const * argv)
             }
             linebuf[sizeof(linebuf) - 1] = '\0';
         }
-        if (!execute_line (cur_line)) {
+        if (!dispatch_line (cur_line)) {
             break;
         }
     }
@@ -16,13 +16,19 @@
 extern bool memory_read (uint64_t address, void * value, uint64_t size_in_bytes);
 extern bool memory_write (uint64_t address, uint64_t value, uint64_t size_in_bytes);
 extern bool memory_status (uint64_t address, void *value);
+extern bool memory_port_available (void);
+extern bool memory_read_direct (uint64_t address, void * value, uint64_t size_in_bytes);
+extern bool memory_write_direct (uint64_t address, const void * value, uint64_t size_in_bytes);
 
 extern void register_read (uint64_t register_a, uint64_t register_b, uint64_t * value_a, uint64_t * value_b);
 extern void register_write (uint64_t register_d, uint64_t value_d);
+extern void set_register_ports (uint32_t ports);
 
 extern void     set_pc (uint64_t pc);
 extern uint64_t get_pc (void);
 extern uint64_t get_ptbr (void);
+extern uint64_t get_cycle_counter (void);
+extern void     get_memory_counters (uint64_t * reads, uint64_t * writes);
 
 /*
  * These are the functions students need to implement for Assignment 2.
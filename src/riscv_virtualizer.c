@@ -10,39 +10,114 @@
 #include "branch_predictor.h"
 #include "cache.h"
 #include "TLB.h"
+#include "config.h"
+#include "ooo_core.h"
+#include "hart.h"
+#include "csr.h"
+#include "profile.h"
+#include "interval_stats.h"
+#include "plugin_host.h"
+#include "pipeview.h"
+
+// register fields each major opcode really reads and writes, filled in by initialise()
+HART_LOCAL struct operand_usage operand_usage_table[128];
+
+// the registers one instruction really uses; csrrwi, csrrsi and csrrci (funct3 bit 2 set) hold an immediate in rs1
+struct operand_usage instruction_operands(uint32_t instruction) {
+    struct operand_usage usage = operand_usage_table[instruction & 0x7F];
+    if ((instruction & 0x7F) == 0b1110011 && (instruction >> 14 & 1)) {
+        usage.rs1 = 0;
+    }
+    return usage;
+}
+
+// instructions that may take the second issue slot: no memory access, no control transfer
+uint8_t alu_instruction(uint32_t instruction) {
+    switch (instruction & 0x7F) {
+        case 0b0010011:
+        case 0b0011011:
+        case 0b0110011:
+        case 0b0111011:
+        case 0b0110111:
+        case 0b0010111:
+            return 1;
+    }
+    return 0;
+}
+
+// Dual issue pairs the instruction at pc with the one at pc + 4 when both are in the same 16 byte I-cache block,
+// the first is an ALU op or a branch predicted not taken, the second is an ALU op that does not read the first's rd
+uint8_t can_pair(uint32_t first, uint32_t second) {
+    if (!(alu_instruction(first) || (first & 0x7F) == 0b1100011) || !alu_instruction(second)) {
+        return 0;
+    }
+    struct operand_usage usage = instruction_operands(first);
+    uint8_t rd = (uint8_t) (first >> 7 & 0x1F);
+    if (!usage.rd || rd == 0) {
+        return 1;
+    }
+    struct operand_usage second_usage = instruction_operands(second);
+    return !((second_usage.rs1 && (second >> 15 & 0x1F) == rd) || (second_usage.rs2 && (second >> 20 & 0x1F) == rd));
+}
 
-uint8_t forwarded_register_read_single (uint64_t reg, uint64_t* value) {
-    if (current_stage_x_register->rd == reg) {
-        return 2;
-    } else if (current_stage_m_register->readWrite == 3 && current_stage_m_register->reg == reg) {
+// Scoreboard: a register is pending while its producer has not reached a stage register decode can forward from -
+// any instruction writing it in execute this cycle, or a load or atomic writing it in memory access.
+uint8_t register_pending(int16_t reg) {
+    if (reg <= 0) {
+        return 0; // unused operand or x0
+    }
+    if (current_stage_x_register->not_stalled && current_stage_m_register->tainted_executions == 0 && (current_stage_x_register->rd == reg || (current_stage_x_register->dual && current_stage_x_register->rd2 == reg))) {
+        return 1;
+    }
+    return (current_stage_m_register->readWrite == 2 || current_stage_m_register->readWrite == 4) && current_stage_m_register->reg == (uint64_t) reg;
+}
+
+// reads a source operand that is not pending, forwarding from memory access or writeback; returns 1 if it was forwarded
+uint8_t forwarded_register_read_single(int16_t reg, uint64_t* value) {
+    if (reg == -1) {
+        *value = (uint64_t) -1;
+        return 1;
+    } else if (reg == 0) {
+        *value = 0;
+        return 1;
+    } else if (current_stage_m_register->dual && current_stage_m_register->reg2 == (uint64_t) reg) {
+        *value = current_stage_m_register->value2; // the second slot is younger, so it wins over reg
+        return 1;
+    } else if (current_stage_m_register->readWrite == 3 && current_stage_m_register->reg == (uint64_t) reg) {
         *value = current_stage_m_register->value;
         return 1;
-    } else if (current_stage_w_register->reg == reg) {
+    } else if (current_stage_w_register->op2 && current_stage_w_register->reg2 == (uint64_t) reg) {
+        *value = current_stage_w_register->value2;
+        return 1;
+    } else if (current_stage_w_register->reg == (uint64_t) reg) {
         *value = current_stage_w_register->value;
         return 1;
     }
     return 0;
 }
 
-int forwarded_register_read (uint64_t register_a, uint64_t register_b, uint64_t * value_a, uint64_t * value_b) {
+void forwarded_register_read(int16_t register_a, int16_t register_b, uint64_t* value_a, uint64_t* value_b) {
     uint8_t aForwarded = forwarded_register_read_single(register_a, value_a);
     uint8_t bForwarded = forwarded_register_read_single(register_b, value_b);
-    if (aForwarded == 2 || bForwarded == 2) {
-        return 1;
-    }
     if (aForwarded && bForwarded) {
-        return 0;
+        return;
     } else if (aForwarded) {
-        register_read(register_b, register_b, value_b, value_b);
+        register_read((uint64_t) register_b, (uint64_t) register_b, value_b, value_b);
     } else if (bForwarded) {
-        register_read(register_a, register_a, value_a, value_a);
+        register_read((uint64_t) register_a, (uint64_t) register_a, value_a, value_a);
     } else {
-        register_read(register_a, register_b, value_a, value_b);
+        register_read((uint64_t) register_a, (uint64_t) register_b, value_a, value_b);
     }
-    return 0;
 }
 
+HART_LOCAL uint8_t illegal_instruction_deferred = 0; // set by the out-of-order core, which reports them when they commit
+HART_LOCAL uint8_t illegal_instruction_seen = 0;
+
 void riscv_illegal_instruction(uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg) {
+    if (illegal_instruction_deferred) {
+        illegal_instruction_seen = 1;
+        return;
+    }
     printf("Illegal instruction @ 0x%016lX: 0x%08X\n", (*pc) - 4, *(uint32_t*) &instruction);
 }
 
@@ -68,9 +143,8 @@ void riscv_lui(uint64_t* pc, struct riscv_instruction instruction, struct stage_
     prepare_register_write(instruction.data.u.rd, (int64_t) (int32_t) temp, new_m_reg);
 }
 
-void riscv_jal(uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg) {
-	// Stores newPC to rd and sets currPC to the old PC + imm
-    prepare_register_write(instruction.data.u.rd, *pc, new_m_reg);
+// jal offset, also used by decode to redirect fetch early
+int64_t jal_offset(struct riscv_instruction instruction) {
     uint64_t immediate = instruction.data.u.imm;
     const uint64_t mask = 0xFFFFF;
     immediate = ((immediate >> 19) & 0b1) << 19 | (mask & (immediate << 12)) >> 1 | ((immediate >> 8) & 0b1) << 10 | (mask & (immediate << 1)) >> 10;
@@ -78,7 +152,13 @@ void riscv_jal(uint64_t* pc, struct riscv_instruction instruction, struct stage_
         immediate |= 0b1111 << 20;
         immediate |= 0xFFFFFFFFFF000000;
     }
-    int64_t offset = immediate << 1;
+    return immediate << 1;
+}
+
+void riscv_jal(uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg) {
+	// Stores newPC to rd and sets currPC to the old PC + imm
+    prepare_register_write(instruction.data.u.rd, *pc, new_m_reg);
+    int64_t offset = jal_offset(instruction);
 	*pc = *pc - 4 + offset; // necessary decrement to retrieve oldPC
 }
 
@@ -239,9 +319,9 @@ void riscv_load_dispatch(uint64_t* pc, struct riscv_instruction instruction, str
 }
 
 void riscv_beq(uint64_t* pc, struct riscv_instruction instruction) {
-    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 11 | (uint32_t) (instruction.data.s.imm2 & 0x01) | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
-    uint16_t sized_range = (uint16_t) (raw_range & 0b111111111110);
-    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (11 << 1)) ? 0b1111 << 12 : 0));
+    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 12 | (uint32_t) (instruction.data.s.imm2 & 0x01) << 11 | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
+    uint16_t sized_range = (uint16_t) (raw_range & 0b1111111111110);
+    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (1 << 12)) ? 0b111 << 13 : 0));
 
     if (current_stage_x_register->rs1_value == current_stage_x_register->rs2_value) {
         *pc = *pc - 4 + extended_range;
@@ -249,9 +329,9 @@ void riscv_beq(uint64_t* pc, struct riscv_instruction instruction) {
 }
 
 void riscv_bne(uint64_t* pc, struct riscv_instruction instruction) {
-    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 11 | (uint32_t) (instruction.data.s.imm2 & 0x01) | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
-    uint16_t sized_range = (uint16_t) (raw_range & 0b111111111110);
-    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (11 << 1)) ? 0b1111 << 12 : 0));
+    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 12 | (uint32_t) (instruction.data.s.imm2 & 0x01) << 11 | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
+    uint16_t sized_range = (uint16_t) (raw_range & 0b1111111111110);
+    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (1 << 12)) ? 0b111 << 13 : 0));
 
     if (current_stage_x_register->rs1_value != current_stage_x_register->rs2_value) {
         *pc = *pc - 4 + extended_range;
@@ -259,9 +339,9 @@ void riscv_bne(uint64_t* pc, struct riscv_instruction instruction) {
 }
 
 void riscv_blt(uint64_t* pc, struct riscv_instruction instruction) {
-    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 11 | (uint32_t) (instruction.data.s.imm2 & 0x01) | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
-    uint16_t sized_range = (uint16_t) (raw_range & 0b111111111110);
-    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (11 << 1)) ? 0b1111 << 12 : 0));
+    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 12 | (uint32_t) (instruction.data.s.imm2 & 0x01) << 11 | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
+    uint16_t sized_range = (uint16_t) (raw_range & 0b1111111111110);
+    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (1 << 12)) ? 0b111 << 13 : 0));
 
 
     if ((int64_t) current_stage_x_register->rs1_value < (int64_t) current_stage_x_register->rs2_value) {
@@ -270,9 +350,9 @@ void riscv_blt(uint64_t* pc, struct riscv_instruction instruction) {
 }
 
 void riscv_bge(uint64_t* pc, struct riscv_instruction instruction) {
-    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 11 | (uint32_t) (instruction.data.s.imm2 & 0x01) | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
-    uint16_t sized_range = (uint16_t) (raw_range & 0b111111111110);
-    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (11 << 1)) ? 0b1111 << 12 : 0));
+    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 12 | (uint32_t) (instruction.data.s.imm2 & 0x01) << 11 | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
+    uint16_t sized_range = (uint16_t) (raw_range & 0b1111111111110);
+    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (1 << 12)) ? 0b111 << 13 : 0));
 
 
     if ((int64_t) current_stage_x_register->rs1_value >= (int64_t) current_stage_x_register->rs2_value) {
@@ -281,9 +361,9 @@ void riscv_bge(uint64_t* pc, struct riscv_instruction instruction) {
 }
 
 void riscv_bltu(uint64_t* pc, struct riscv_instruction instruction) {
-    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 11 | (uint32_t) (instruction.data.s.imm2 & 0x01) | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
-    uint16_t sized_range = (uint16_t) (raw_range & 0b111111111110);
-    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (11 << 1)) ? 0b1111 << 12 : 0));
+    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 12 | (uint32_t) (instruction.data.s.imm2 & 0x01) << 11 | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
+    uint16_t sized_range = (uint16_t) (raw_range & 0b1111111111110);
+    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (1 << 12)) ? 0b111 << 13 : 0));
 
 
     if (current_stage_x_register->rs1_value < current_stage_x_register->rs2_value) {
@@ -291,9 +371,9 @@ void riscv_bltu(uint64_t* pc, struct riscv_instruction instruction) {
     }}
 
 void riscv_bgeu(uint64_t* pc, struct riscv_instruction instruction) {
-    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 11 | (uint32_t) (instruction.data.s.imm2 & 0x01) | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
-    uint16_t sized_range = (uint16_t) (raw_range & 0b111111111110);
-    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (11 << 1)) ? 0b1111 << 12 : 0));
+    uint32_t raw_range = (uint32_t) instruction.data.s.imm >> 6 << 12 | (uint32_t) (instruction.data.s.imm2 & 0x01) << 11 | (uint32_t) (instruction.data.s.imm & 0b0111111) << 5 | (uint32_t) instruction.data.s.imm2 >> 1 << 1;
+    uint16_t sized_range = (uint16_t) (raw_range & 0b1111111111110);
+    int16_t extended_range = (int16_t) (sized_range | ((sized_range & (1 << 12)) ? 0b111 << 13 : 0));
 
 
     if (current_stage_x_register->rs1_value >= current_stage_x_register->rs2_value) {
@@ -408,6 +488,109 @@ void riscv_store_dispatch(uint64_t* pc, struct riscv_instruction instruction, st
     }
 }
 
+// A extension: lr, sc and the AMOs; the memory stage does the whole read-modify-write in one D-cache access
+void riscv_atomic_dispatch(uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg) {
+    uint8_t funct5 = (uint8_t) (instruction.data.r.funct7 >> 2);
+    switch (funct5) {
+        case 0b00010: // lr
+        case 0b00011: // sc
+        case 0b00001: // amoswap
+        case 0b00000: // amoadd
+        case 0b00100: // amoxor
+        case 0b01100: // amoand
+        case 0b01000: // amoor
+        case 0b10000: // amomin
+        case 0b10100: // amomax
+        case 0b11000: // amominu
+        case 0b11100: // amomaxu
+            break;
+        default:
+            riscv_illegal_instruction(pc, instruction, NULL);
+            return;
+    }
+    if (instruction.data.r.funct3 != 0b010 && instruction.data.r.funct3 != 0b011) {
+        riscv_illegal_instruction(pc, instruction, NULL);
+        return;
+    }
+    uint8_t size = (uint8_t) (instruction.data.r.funct3 == 0b010 ? 4 : 8);
+    if (current_stage_x_register->rs1_value & (size - 1)) { // no traps, so reported like an illegal instruction
+        riscv_illegal_instruction(pc, instruction, NULL);
+        return;
+    }
+    new_m_reg->readWrite = 4;
+    new_m_reg->address = current_stage_x_register->rs1_value;
+    new_m_reg->size = size;
+    new_m_reg->reg = instruction.data.r.rd;
+    new_m_reg->value = current_stage_x_register->rs2_value;
+    new_m_reg->signExtend = size == 4;
+    new_m_reg->amo = funct5;
+}
+
+// CSR instructions; ecall, ebreak and the other funct3 0 instructions do nothing here
+void riscv_system_dispatch(uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg) {
+    uint8_t funct3 = instruction.data.i.funct3;
+    if (funct3 == 0) {
+        return;
+    }
+    uint64_t old_value;
+    if (funct3 == 0b100 || !csr_read(instruction.data.i.imm, &old_value)) {
+        riscv_illegal_instruction(pc, instruction, NULL);
+        return;
+    }
+    // csrrwi, csrrsi and csrrci take the rs1 field as a 5 bit immediate
+    uint64_t operand = funct3 & 0b100 ? instruction.data.i.rs1 : current_stage_x_register->rs1_value;
+    uint64_t new_value = old_value;
+    if ((funct3 & 0b11) == 0b01) {
+        new_value = operand;
+    } else if ((funct3 & 0b11) == 0b10) {
+        new_value = old_value | operand;
+    } else {
+        new_value = old_value & ~operand;
+    }
+    // csrrs and csrrc with x0 (or a zero immediate) only read, so they work on read-only counters
+    if (((funct3 & 0b11) == 0b01 || instruction.data.i.rs1 != 0) && !csr_write(instruction.data.i.imm, new_value)) {
+        riscv_illegal_instruction(pc, instruction, NULL);
+        return;
+    }
+    prepare_register_write(instruction.data.i.rd, old_value, new_m_reg);
+}
+
+// AMO arithmetic on the old memory value, the low 32 bits of both operands for a .w
+uint64_t amo_modify(uint64_t old_value, const struct atomic_update* update) {
+    uint64_t operand = update->size == 4 ? (uint32_t) update->operand : update->operand;
+    int64_t old_signed = update->size == 4 ? (int64_t) (int32_t) old_value : (int64_t) old_value;
+    int64_t operand_signed = update->size == 4 ? (int64_t) (int32_t) operand : (int64_t) operand;
+    switch (update->operation) {
+        case 0b00001:
+            return operand;
+        case 0b00000:
+            return old_value + operand;
+        case 0b00100:
+            return old_value ^ operand;
+        case 0b01100:
+            return old_value & operand;
+        case 0b01000:
+            return old_value | operand;
+        case 0b10000:
+            return old_signed < operand_signed ? old_value : operand;
+        case 0b10100:
+            return old_signed > operand_signed ? old_value : operand;
+        case 0b11000:
+            return old_value < operand ? old_value : operand;
+        default: // 0b11100
+            return old_value > operand ? old_value : operand;
+    }
+}
+
+// the D-cache side of an atomic the execute stage set up (readWrite 4, funct5 in amo, rs2 in value)
+void prepare_atomic_update(uint8_t funct5, uint64_t operand, uint8_t size, struct atomic_update* update) {
+    update->modify = funct5 == 0b00010 || funct5 == 0b00011 ? NULL : amo_modify;
+    update->operand = operand;
+    update->operation = funct5;
+    update->size = size;
+    update->conditional = funct5 == 0b00011;
+}
+
 void riscv_addiw(uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg) {
     //add the value of current_stage_x_register->rs1_value and immediate and save into rd
     uint64_t temp = instruction.data.i.imm;
@@ -437,7 +620,7 @@ void riscv_slliw(uint64_t* pc, struct riscv_instruction instruction, struct stag
 }
 
 void riscv_slli(uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg) {
-    uint64_t temp = instruction.data.i.imm;
+    uint64_t temp = instruction.data.i.imm & 0x3F;
 
     prepare_register_write(instruction.data.i.rd, current_stage_x_register->rs1_value << temp, new_m_reg);
 }
@@ -484,7 +667,7 @@ void riscv_srliw(uint64_t* pc, struct riscv_instruction instruction, struct stag
 }
 
 void riscv_srli(uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg) {
-    uint64_t temp = instruction.data.i.imm;
+    uint64_t temp = instruction.data.i.imm & 0x3F;
 
     prepare_register_write(instruction.data.i.rd, current_stage_x_register->rs1_value >> temp, new_m_reg);
 }
@@ -496,7 +679,7 @@ void riscv_sraiw(uint64_t* pc, struct riscv_instruction instruction, struct stag
 }
 
 void riscv_srai(uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg) {
-    uint64_t temp = instruction.data.i.imm;
+    uint64_t temp = instruction.data.i.imm & 0x3F;
 
     prepare_register_write(instruction.data.r.rd, (uint64_t)(((int64_t) current_stage_x_register->rs1_value) >> ((int64_t) temp)), new_m_reg);
 }
@@ -556,7 +739,8 @@ void riscv_arithmetic1_dispatch(uint64_t* pc, struct riscv_instruction instructi
             riscv_addi(pc, instruction, new_m_reg);
             break;
         case 0b001:
-            if (instruction.data.r.funct7 != 0) {
+            // RV64 shifts take a 6 bit shamt, so only the upper six bits of funct7 (funct6) select the operation
+            if (instruction.data.r.funct7 >> 1 != 0) {
                 riscv_illegal_instruction(pc, instruction, NULL);
                 break;
             }
@@ -572,11 +756,11 @@ void riscv_arithmetic1_dispatch(uint64_t* pc, struct riscv_instruction instructi
             riscv_xori(pc, instruction, new_m_reg);
             break;
         case 0b101:
-            switch(instruction.data.r.funct7) {
-                case 0b0000000:
+            switch(instruction.data.r.funct7 >> 1) {
+                case 0b000000:
                     riscv_srli(pc, instruction, new_m_reg);
                     break;
-                case 0b0100000:
+                case 0b010000:
                     riscv_srai(pc, instruction, new_m_reg);
                     break;
                 default:
@@ -953,24 +1137,85 @@ void riscv_arithmetic2_64_dispatch(uint64_t* pc, struct riscv_instruction instru
     }
 }
 
-void (*major_dispatch_table[128]) (uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg);
+HART_LOCAL void (*major_dispatch_table[128]) (uint64_t* pc, struct riscv_instruction instruction, struct stage_reg_m* new_m_reg);
 
 // we cannot edit main method....
-int has_initialised = 0;
-
-struct cache_table instruction_cache;
-struct cache_table data_cache;
+HART_LOCAL int has_initialised = 0;
+
+HART_LOCAL struct cache_table instruction_cache;
+HART_LOCAL struct cache_table data_cache;
+HART_LOCAL struct tlb itlb;
+HART_LOCAL struct tlb dtlb;
+HART_LOCAL struct tlb l2_tlb;
+HART_LOCAL uint8_t execute_redirected = 0; // set when execute redirects fetch this cycle, decode must not refetch over it
+HART_LOCAL uint8_t decode_redirected = 0; // set when decode redirects a jal this cycle, fetch has no target address yet
+// A memory access that stalled is finished from its saved copy while fetch restarts at it, so the instruction goes
+// through memory a second time. That is harmless for loads, but an atomic or a store must only happen once: the
+// second pass of an atomic just writes back the result of the first, and that of a store does not write again.
+HART_LOCAL uint8_t atomic_replayed = 0;
+HART_LOCAL uint64_t atomic_replayed_pc;
+HART_LOCAL uint64_t atomic_replayed_value;
+HART_LOCAL uint8_t store_replayed = 0;
+HART_LOCAL uint64_t store_replayed_pc;
 
 void initialise() {
     if (has_initialised) {
         return;
     }
     has_initialised = 1;
-    construct_cache(&instruction_cache, 512, CACHE_INSTRUCTION);
-    construct_cache(&data_cache, 2048, CACHE_DATA);
+    config_lock();
+    construct_cache(&instruction_cache, sim_config.icache_blocks, CACHE_INSTRUCTION, (uint8_t) sim_config.cache_tag_only);
+    // coherent D-caches leave the values in memory, see cache.c
+    construct_cache(&data_cache, sim_config.dcache_blocks, CACHE_DATA, (uint8_t) (sim_config.cache_tag_only || sim_config.harts > 1));
+    if (sim_config.victim_cache_entries) {
+        construct_victim_cache(&data_cache, (uint32_t) sim_config.victim_cache_entries);
+    }
+    if (sim_config.harts > 1) {
+        join_coherence(&data_cache);
+    }
+    construct_tlb(&itlb, (uint32_t) sim_config.itlb_entries, (uint32_t) sim_config.tlb_ways, (uint32_t) sim_config.walk_cache_entries);
+    construct_tlb(&dtlb, (uint32_t) sim_config.dtlb_entries, (uint32_t) sim_config.tlb_ways, (uint32_t) sim_config.walk_cache_entries);
+    if (sim_config.l2tlb_entries) {
+        construct_tlb(&l2_tlb, (uint32_t) sim_config.l2tlb_entries, (uint32_t) sim_config.l2tlb_ways, 0);
+        l2_tlb.latency = (uint32_t) sim_config.l2tlb_latency;
+        itlb.l2 = &l2_tlb;
+        dtlb.l2 = &l2_tlb;
+    }
+    construct_btb((uint32_t) sim_config.btb_entries, (uint32_t) sim_config.btb_ways);
+    construct_ras((uint32_t) sim_config.ras_entries);
+    construct_indirect_predictor((uint32_t) sim_config.itp_entries, (uint8_t) sim_config.itp_path_length);
+    if (sim_config.issue_width < 1 || sim_config.issue_width > 2) {
+        printf("issue width must be 1 or 2, not %lu\n", (unsigned long) sim_config.issue_width);
+        exit(1);
+    }
+    set_register_ports((uint32_t) sim_config.issue_width); // a read port pair and a write port per slot
+    if (sim_config.core_type > CORE_OUT_OF_ORDER) {
+        printf("core type must be 0 (in-order) or 1 (out-of-order), not %lu\n", (unsigned long) sim_config.core_type);
+        exit(1);
+    }
+    if (sim_config.core_type == CORE_OUT_OF_ORDER) {
+        construct_ooo_core((uint32_t) sim_config.rob_entries, (uint32_t) sim_config.iq_entries, (uint32_t) sim_config.lsq_entries, (uint32_t) sim_config.issue_width);
+    }
+    construct_branch_predictor((uint8_t) sim_config.bp_type, (uint8_t) sim_config.bp_table_bits, (uint8_t) sim_config.bp_history_length);
     for (int i = 0; i < 128; i++) {
         major_dispatch_table[i] = riscv_illegal_instruction;
     }
+    for (int i = 0; i < 128; i++) {
+        operand_usage_table[i] = (struct operand_usage) {0, 0, 0};
+    }
+    operand_usage_table[0b0010111] = (struct operand_usage) {0, 0, 1}; // auipc
+    operand_usage_table[0b0110111] = (struct operand_usage) {0, 0, 1}; // lui
+    operand_usage_table[0b1101111] = (struct operand_usage) {0, 0, 1}; // jal
+    operand_usage_table[0b1100111] = (struct operand_usage) {1, 0, 1}; // jalr
+    operand_usage_table[0b0000011] = (struct operand_usage) {1, 0, 1}; // loads
+    operand_usage_table[0b1100011] = (struct operand_usage) {1, 1, 0}; // branches
+    operand_usage_table[0b0100011] = (struct operand_usage) {1, 1, 0}; // stores
+    operand_usage_table[0b0101111] = (struct operand_usage) {1, 1, 1}; // atomics
+    operand_usage_table[0b1110011] = (struct operand_usage) {1, 0, 1}; // CSR instructions, see instruction_operands for the immediate forms
+    operand_usage_table[0b0010011] = (struct operand_usage) {1, 0, 1};
+    operand_usage_table[0b0011011] = (struct operand_usage) {1, 0, 1};
+    operand_usage_table[0b0110011] = (struct operand_usage) {1, 1, 1};
+    operand_usage_table[0b0111011] = (struct operand_usage) {1, 1, 1};
     // all U/UJ decoder types here (they have no subtables)
     major_dispatch_table[0b0010111] = riscv_auipc;
     major_dispatch_table[0b0110111] = riscv_lui;
@@ -981,146 +1226,394 @@ void initialise() {
     major_dispatch_table[0b0000011] = riscv_load_dispatch;
     major_dispatch_table[0b1100011] = riscv_branch_dispatch;
     major_dispatch_table[0b0100011] = riscv_store_dispatch;
+    major_dispatch_table[0b0101111] = riscv_atomic_dispatch;
     major_dispatch_table[0b0010011] = riscv_arithmetic1_dispatch;
     major_dispatch_table[0b0011011] = riscv_arithmetic1_64_dispatch;
     major_dispatch_table[0b0110011] = riscv_arithmetic2_dispatch;
     major_dispatch_table[0b0111011] = riscv_arithmetic2_64_dispatch;
     major_dispatch_table[0b0001111] = riscv_nop; // fence instructions
-    major_dispatch_table[0b1110011] = riscv_nop; // CSR/ECALL/EBREAK
+    major_dispatch_table[0b1110011] = riscv_system_dispatch; // CSR/ECALL/EBREAK
+}
+
+// "tlbflush" command - invalidates translations of an ASID and/or a virtual address (-1 for any) in every TLB
+void flush_tlbs(int32_t asid, int64_t virtual_address) {
+    if (!has_initialised) {
+        return; // TLBs not built yet, nothing cached
+    }
+    tlb_flush(&itlb, asid, virtual_address);
+    tlb_flush(&dtlb, asid, virtual_address);
+    if (itlb.l2 != NULL) {
+        tlb_flush(itlb.l2, asid, virtual_address);
+    }
+}
+
+// "coherencestats" command - MESI traffic seen by this hart's D-cache
+void print_coherence_stats() {
+    printf("Invalidations: %llu\n", (unsigned long long) data_cache.coherence.invalidations);
+    printf("Forced writebacks: %llu\n", (unsigned long long) data_cache.coherence.writebacks);
+    printf("Upgrades: %llu\n", (unsigned long long) data_cache.coherence.upgrades);
+}
+
+// "cpistack" command - this hart's cycles by what they were spent on, as a share of the CPI
+void print_cpi_stack() {
+    static const char* cause_names[CPI_CAUSES] = {"base", "icache miss", "itlb walk", "dcache miss", "dtlb walk", "load-use", "branch mispredict", "memory port"};
+    uint64_t cycles = 0;
+    for (int i = 0; i < CPI_CAUSES; i++) {
+        cycles += pipeline_events.cpi_cycles[i];
+    }
+    uint64_t instructions = pipeline_events.instructions_retired;
+    printf("Cycles: %llu, instructions: %llu, CPI: %.3f\n", (unsigned long long) cycles, (unsigned long long) instructions,
+           instructions ? (double) cycles / (double) instructions : 0.0);
+    for (int i = 0; i < CPI_CAUSES; i++) {
+        uint64_t count = pipeline_events.cpi_cycles[i];
+        printf("%-18s %12llu cycles %8.3f CPI %6.2f%%\n", cause_names[i], (unsigned long long) count,
+               instructions ? (double) count / (double) instructions : 0.0, cycles ? 100.0 * (double) count / (double) cycles : 0.0);
+    }
+}
+
+// Predictor training and mispredict count for the control transfer executed last cycle. A memory stall found that same
+// cycle squashes it and it is executed again after the refetch, so like the trace record it only trains (and counts) once
+// it moves on to memory access.
+HART_LOCAL uint8_t training_pending = 0;
+HART_LOCAL uint64_t training_pc;
+HART_LOCAL uint64_t training_target;
+HART_LOCAL uint64_t training_bp_history;
+HART_LOCAL uint8_t training_conditional;
+HART_LOCAL uint32_t training_instruction;
+HART_LOCAL uint64_t training_path_history;
+HART_LOCAL uint8_t training_mispredicted;
+
+void commit_training(uint8_t discard) {
+    if (training_pending && !discard) {
+        if (training_mispredicted) {
+            pipeline_events.mispredicts++;
+            if (profiling) {
+                profile_mispredict(training_pc);
+            }
+        }
+        uint8_t taken = training_target != training_pc + 4;
+        if (training_conditional) {
+            update_direction(training_pc, training_bp_history, taken);
+        }
+        if (taken) {
+            update_entry(training_pc, training_target, training_conditional);
+        }
+        if ((training_instruction & 0x7F) == 0b1100111) {
+            update_indirect(training_pc, training_instruction, training_path_history, training_target);
+        }
+    }
+    training_pending = 0;
 }
 
-struct tlb itlb;
-struct tlb dtlb;
+// "branchtrace" command - records every executed control transfer to a file for bpreplay, NULL stops recording
+HART_LOCAL FILE* branch_trace = NULL;
+HART_LOCAL struct branch_trace_record pending_trace_record;
+HART_LOCAL uint8_t trace_pending = 0; // 1 if execute ran an instruction last cycle, 2 if it was also a control transfer
+HART_LOCAL uint8_t trace_pending_second = 0; // the second issue slot ran too, it follows the control transfer
+HART_LOCAL uint32_t trace_instructions = 0;
+HART_LOCAL uint8_t trace_mispredicted = 0; // for the plugins, the trace format has no room for it
+
+// also reports control transfers to plugins, which go through the same pending record while no trace is recorded
+void commit_trace(uint8_t discard) {
+    // a memory stall replays the instruction executed last cycle, so it is only counted once it moves on
+    if (trace_pending && !discard) {
+        if (trace_pending == 2 && (plugin_hooks & PLUGIN_HOOK_BRANCH)) {
+            plugin_branch(pending_trace_record.pc, pending_trace_record.target, pending_trace_record.taken, trace_mispredicted);
+        }
+        if (branch_trace != NULL) {
+            trace_instructions++;
+            if (trace_pending == 2) {
+                pending_trace_record.instructions = trace_instructions;
+                fwrite(&pending_trace_record, sizeof(struct branch_trace_record), 1, branch_trace);
+                trace_instructions = 0;
+            }
+            trace_instructions += trace_pending_second;
+        }
+    }
+    trace_pending = 0;
+    trace_pending_second = 0;
+}
+
+void set_branch_trace(const char* file) {
+    if (branch_trace != NULL) {
+        commit_trace(0);
+        fclose(branch_trace);
+        branch_trace = NULL;
+    }
+    if (file == NULL) {
+        return;
+    }
+    branch_trace = fopen(file, "wb");
+    if (branch_trace == NULL) {
+        fprintf(stderr, "branchtrace: cannot open %s\n", file);
+    }
+    trace_instructions = 0;
+}
+
+// the framework only stops on an ebreak once everything older has committed
+uint8_t core_drained() {
+    return !has_initialised || sim_config.core_type != CORE_OUT_OF_ORDER || ooo_drained();
+}
+
+// CPI stack cause of a stalled memory access, from the copy of it kept for the replay
+uint8_t memory_stall_cause(const struct stage_reg_m* stalled) {
+    if (stalled->wasStalled == 2) {
+        return CPI_MEMORY_PORT;
+    }
+    return (uint8_t) (stalled->stallStatus != 0xFF ? CPI_DTLB_WALK : CPI_DCACHE_MISS);
+}
+
+// Every cycle goes to the CPI stack as memory access finishes with it: base if an instruction retires, the stalled
+// access while it waits, is replayed and the pipeline refills behind it, else whatever left memory access empty
+uint8_t memory_cycle_cause(const struct stage_reg_w* new_w_reg) {
+    if (new_w_reg->global_memory_stall) {
+        return memory_stall_cause(&new_w_reg->memory_register);
+    }
+    if (current_stage_w_register->tainted_executions) {
+        return memory_stall_cause(&current_stage_w_register->memory_register);
+    }
+    if (current_stage_m_register->wasStalled) {
+        return memory_stall_cause(current_stage_m_register);
+    }
+    return current_stage_m_register->executed ? (uint8_t) CPI_BASE : current_stage_m_register->bubble;
+}
 
 // API
 
 void stage_fetch (struct stage_reg_d* new_d_reg) {
     initialise();
+    if (decode_redirected) {
+        // the target is only known at the end of decode, so this cycle's fetch is lost
+        decode_redirected = 0;
+        memset(new_d_reg, 0, sizeof(struct stage_reg_d));
+        new_d_reg->bubble = CPI_MISPREDICT;
+        if (pipeview != NULL) {
+            pipeview_fetch_stall(get_pc(), CPI_MISPREDICT);
+        }
+        return;
+    }
+    if (sim_config.core_type == CORE_OUT_OF_ORDER && ooo_fetch_blocked()) {
+        memset(new_d_reg, 0, sizeof(struct stage_reg_d));
+        return;
+    }
     uint64_t pc = get_pc();
     uint32_t physical_pc = 0;
     uint8_t status = get_address(&itlb, (uint32_t) pc, &physical_pc, current_stage_d_register->will_be_stalled == 2 ? current_stage_d_register->tlb_stall_status : (uint8_t) 0xFF);
+    if (profiling) {
+        profile_fetch(pc);
+    }
     uint8_t memory_read_available = 0;
     if (status == 0xFE) {
         memory_read_available = 1;
     } else if (status != 0xFF) {
+        memset(new_d_reg, 0, sizeof(struct stage_reg_d));
         new_d_reg->will_be_stalled = 2;
         new_d_reg->tlb_stall_status = status;
+        new_d_reg->bubble = CPI_ITLB_WALK;
+        pipeline_events.fetch_stall_cycles++;
+        if (pipeview != NULL) {
+            pipeview_fetch_stall(pc, CPI_ITLB_WALK);
+        }
         return;
     }
-    uint8_t read_status;
-    if (read_status = read_access(&instruction_cache, physical_pc, 4, (void*) &new_d_reg->instruction, current_stage_d_register->will_be_stalled == 1, memory_read_available)) {
+    uint8_t read_status = read_access(&instruction_cache, physical_pc, 4, (void*) &new_d_reg->instruction, current_stage_d_register->will_be_stalled == 1, memory_read_available);
+    if (profiling) {
+        profile_fetch(pc);
+    }
+    if (read_status) {
         // stall
         memset(new_d_reg, 0, sizeof(struct stage_reg_d));
         new_d_reg->tlb_stall_status = 0xFF;
         new_d_reg->will_be_stalled = (uint8_t) (read_status == 2 ? 3 : 1);
+        new_d_reg->bubble = (uint8_t) (read_status == 2 ? CPI_MEMORY_PORT : CPI_ICACHE_MISS);
+        pipeline_events.fetch_stall_cycles++;
+        if (pipeview != NULL) {
+            pipeview_fetch_stall(pc, new_d_reg->bubble);
+        }
         return;
     }
     new_d_reg->pc = pc;
-    pc = predict_address(pc);
+    new_d_reg->bp_history = branch_history;
+    new_d_reg->path_history = path_history;
+    ras_checkpoint(&new_d_reg->ras_top, &new_d_reg->ras_value);
+    pc = predict_address(pc, new_d_reg->instruction);
+    new_d_reg->dual = 0;
+    if (sim_config.issue_width > 1 && pc == new_d_reg->pc + 4 && (pc & 0xF) != 0) {
+        // the rest of the block came in with the first slot, so the second is read from it as part of the same access
+        uint32_t second = 0;
+        if (!read_resident_word(&instruction_cache, physical_pc + 4, &second) && can_pair(new_d_reg->instruction, second)) {
+            new_d_reg->instruction2 = second;
+            new_d_reg->dual = 1;
+            pc = predict_address(pc, new_d_reg->instruction2);
+        }
+    }
     new_d_reg->new_pc = pc;
     set_pc(pc);
+    new_d_reg->trace_id = 0;
+    new_d_reg->trace_id2 = 0;
+    if (pipeview != NULL) {
+        new_d_reg->trace_id = pipeview_fetch(new_d_reg->pc, new_d_reg->instruction);
+        if (new_d_reg->dual) {
+            new_d_reg->trace_id2 = pipeview_fetch(new_d_reg->pc + 4, new_d_reg->instruction2);
+        }
+    }
     new_d_reg->not_stalled = 1;
     new_d_reg->will_be_stalled = 0;
 }
 
 void stage_decode (struct stage_reg_x* new_x_reg) {
-    if (!current_stage_d_register->not_stalled || current_stage_w_register->global_memory_stall) {
+    if (sim_config.core_type == CORE_OUT_OF_ORDER) {
+        ooo_dispatch();
+        return;
+    }
+    if (!current_stage_d_register->not_stalled || current_stage_w_register->global_memory_stall || execute_redirected) {
         new_x_reg->not_stalled = 0;
+        if (current_stage_w_register->global_memory_stall) {
+            new_x_reg->bubble = memory_stall_cause(&current_stage_w_register->memory_register);
+        } else {
+            new_x_reg->bubble = execute_redirected ? (uint8_t) CPI_MISPREDICT : current_stage_d_register->bubble;
+        }
+        if (pipeview != NULL && current_stage_d_register->not_stalled) {
+            pipeview_note(current_stage_d_register->trace_id, PIPEVIEW_FLUSH, new_x_reg->bubble);
+            pipeview_note(current_stage_d_register->trace_id2, PIPEVIEW_FLUSH, new_x_reg->bubble);
+        }
         return;
     }
     initialise();
     new_x_reg->pc = current_stage_d_register->pc;
     new_x_reg->new_pc = current_stage_d_register->new_pc;
+    new_x_reg->bp_history = current_stage_d_register->bp_history;
+    new_x_reg->path_history = current_stage_d_register->path_history;
+    new_x_reg->ras_top = current_stage_d_register->ras_top;
+    new_x_reg->ras_value = current_stage_d_register->ras_value;
     new_x_reg->instruction = *(struct riscv_instruction*) &current_stage_d_register->instruction;
+    new_x_reg->trace_id = current_stage_d_register->trace_id;
+    new_x_reg->trace_id2 = 0;
     new_x_reg->not_stalled = 1;
     uint8_t opcode = new_x_reg->instruction.data.i.opcode;
-    uint8_t decoding_type = 0; // 0 = I, 1 = U, 2 = S, 3 = R
-    switch (opcode) {
-        case 0b0010111:
-        case 0b0110111:
-        case 0b1101111:
-            decoding_type = 1;
-            break;
-        case 0b0100011:
-        case 0b1100011:
-            decoding_type = 2;
-            break;
-        case 0b0110011:
-        case 0b0111011:
-            decoding_type = 3;
-    }
-    int16_t rs1 = -1;
-    int16_t rs2 = -1;
-    int16_t rd = -1;
-    if (decoding_type == 0) {
-        rs1 = new_x_reg->instruction.data.i.rs1;
-        rd = new_x_reg->instruction.data.i.rd;
-    } else if (decoding_type == 1) {
-        rd = new_x_reg->instruction.data.u.rd;
-    } else if (decoding_type == 2) {
-        rs1 = new_x_reg->instruction.data.s.rs1;
-        rs2 = new_x_reg->instruction.data.s.rs2;
-    } else if (decoding_type == 3) {
-        rs1 = new_x_reg->instruction.data.r.rs1;
-        rs2 = new_x_reg->instruction.data.r.rs2;
-        rd = new_x_reg->instruction.data.r.rd;
-    }
-    if (current_stage_m_register->readWrite == 2 && (current_stage_m_register->reg == rs1 || current_stage_m_register->reg == rs2 || current_stage_m_register->reg == rd)) {
+    // rs1, rs2 and rd sit in the same bits in every format that has them
+    struct operand_usage usage = instruction_operands(current_stage_d_register->instruction);
+    int16_t rs1 = (int16_t) (usage.rs1 ? new_x_reg->instruction.data.r.rs1 : -1);
+    int16_t rs2 = (int16_t) (usage.rs2 ? new_x_reg->instruction.data.r.rs2 : -1);
+    int16_t rd = (int16_t) (usage.rd && new_x_reg->instruction.data.r.rd ? new_x_reg->instruction.data.r.rd : -1);
+    if (register_pending(rs1) || register_pending(rs2)) {
         set_pc(current_stage_d_register->pc);
+        ras_repair(current_stage_d_register->ras_top, current_stage_d_register->ras_value, 0, 0);
         new_x_reg->rs2_value = (uint64_t) -1;
         new_x_reg->rs1_value = (uint64_t) -1;
         new_x_reg->rs1 = -1;
         new_x_reg->rs2 = -1;
         new_x_reg->rd = -1;
         new_x_reg->not_stalled = 0;
+        new_x_reg->bubble = CPI_LOAD_USE;
+        if (pipeview != NULL) { // decode stalls by fetching the instruction again
+            pipeview_note(current_stage_d_register->trace_id, PIPEVIEW_STALL, CPI_LOAD_USE);
+            pipeview_note(current_stage_d_register->trace_id2, PIPEVIEW_STALL, CPI_LOAD_USE);
+        }
         return;
     }
     new_x_reg->rs1 = rs1;
     new_x_reg->rs2 = rs2;
     new_x_reg->rd = rd;
-    int register_stall = 0;
-    if (rs1 == -1 && rs2 == -1) {
-        new_x_reg->rs2_value = (uint64_t) -1;
-        new_x_reg->rs1_value = (uint64_t) -1;
-    } else if (rs1 != -1 && rs2 == -1) {
-        register_stall = forwarded_register_read(new_x_reg->instruction.data.r.rs1, 0, &new_x_reg->rs1_value, &new_x_reg->rs2_value);
-        new_x_reg->rs2_value = (uint64_t) -1;
-    } else {
-        register_stall = forwarded_register_read(new_x_reg->instruction.data.r.rs1, new_x_reg->instruction.data.r.rs2, &new_x_reg->rs1_value, &new_x_reg->rs2_value);
+    forwarded_register_read(rs1, rs2, &new_x_reg->rs1_value, &new_x_reg->rs2_value);
+    new_x_reg->dual = 0;
+    if (current_stage_d_register->dual) {
+        memcpy(&new_x_reg->instruction2, &current_stage_d_register->instruction2, sizeof(current_stage_d_register->instruction2));
+        struct operand_usage second_usage = instruction_operands(current_stage_d_register->instruction2);
+        int16_t rs1_2 = (int16_t) (second_usage.rs1 ? new_x_reg->instruction2.data.r.rs1 : -1);
+        int16_t rs2_2 = (int16_t) (second_usage.rs2 ? new_x_reg->instruction2.data.r.rs2 : -1);
+        if (register_pending(rs1_2) || register_pending(rs2_2)) {
+            // issue the first slot alone and refetch the second
+            set_pc(current_stage_d_register->pc + 4);
+            if (pipeview != NULL) {
+                pipeview_note(current_stage_d_register->trace_id2, PIPEVIEW_STALL, CPI_LOAD_USE);
+            }
+        } else {
+            new_x_reg->dual = 1;
+            new_x_reg->trace_id2 = current_stage_d_register->trace_id2;
+            new_x_reg->rd2 = (int16_t) (new_x_reg->instruction2.data.r.rd ? new_x_reg->instruction2.data.r.rd : -1);
+            forwarded_register_read(rs1_2, rs2_2, &new_x_reg->rs1_value2, &new_x_reg->rs2_value2);
+        }
     }
-    if (register_stall) {
-        set_pc(current_stage_d_register->pc);
-        new_x_reg->rs2_value = (uint64_t) -1;
-        new_x_reg->rs1_value = (uint64_t) -1;
-        new_x_reg->rs1 = -1;
-        new_x_reg->rs2 = -1;
-        new_x_reg->rd = -1;
-        new_x_reg->not_stalled = 0;
+    // direct jumps are resolved here instead of waiting for execute when fetch did not predict the target, which
+    // costs the one fetch cycle the target takes to come out of decode
+    if (opcode == 0b1101111) {
+        uint64_t target = new_x_reg->pc + jal_offset(new_x_reg->instruction);
+        if (target != new_x_reg->new_pc) {
+            set_pc(target);
+            new_x_reg->new_pc = target;
+            decode_redirected = 1;
+        }
     }
-
 }
 
 
+// runs the second issue slot through the same handlers, which read their operands from current_stage_x_register
+void execute_second_slot(struct stage_reg_m* new_m_reg) {
+    const struct stage_reg_x* first = current_stage_x_register;
+    struct stage_reg_x second = *first;
+    second.pc = first->pc + 4;
+    second.instruction = first->instruction2;
+    second.rs1_value = first->rs1_value2;
+    second.rs2_value = first->rs2_value2;
+    struct stage_reg_m second_m;
+    memset(&second_m, 0, sizeof(struct stage_reg_m));
+    uint64_t pc = second.pc + 4;
+    current_stage_x_register = &second;
+    major_dispatch_table[second.instruction.data.u.opcode](&pc, second.instruction, &second_m);
+    current_stage_x_register = first;
+    new_m_reg->dual = second_m.readWrite == 3;
+    new_m_reg->reg2 = second_m.reg;
+    new_m_reg->value2 = second_m.value;
+}
+
 void stage_execute (struct stage_reg_m* new_m_reg) {
+    if (sim_config.core_type == CORE_OUT_OF_ORDER) {
+        ooo_execute();
+        return;
+    }
+    execute_redirected = 0;
+    commit_training(current_stage_w_register->global_memory_stall);
+    if (branch_trace != NULL || (plugin_hooks & PLUGIN_HOOK_BRANCH)) {
+        commit_trace(current_stage_w_register->global_memory_stall);
+    }
     if (current_stage_w_register->global_memory_stall) {
+        if (pipeview != NULL && current_stage_x_register->not_stalled) {
+            uint8_t cause = memory_stall_cause(&current_stage_w_register->memory_register);
+            pipeview_note(current_stage_x_register->trace_id, PIPEVIEW_FLUSH, cause);
+            pipeview_note(current_stage_x_register->trace_id2, PIPEVIEW_FLUSH, cause);
+        }
         memcpy(new_m_reg, &current_stage_w_register->memory_register, sizeof(struct stage_reg_m));
         if (current_stage_m_register->tainted_executions > 0) {
             new_m_reg->tainted_executions = (uint8_t) (current_stage_m_register->tainted_executions - 1);
             //return;
         }
         set_pc(new_m_reg->pc);
+        ras_repair(new_m_reg->ras_top, new_m_reg->ras_value, 0, 0);
         new_m_reg->tainted_executions = 1; // flush decode
         return;
     }
     new_m_reg->wasStalled = 0;
     new_m_reg->tainted_executions = 0;
     new_m_reg->readWrite = 0;
+    new_m_reg->dual = 0;
+    new_m_reg->executed = 0;
+    new_m_reg->bubble = CPI_BASE;
     new_m_reg->pc = current_stage_x_register->pc;
+    new_m_reg->ras_top = current_stage_x_register->ras_top;
+    new_m_reg->ras_value = current_stage_x_register->ras_value;
     if (!current_stage_x_register->not_stalled) {
+        new_m_reg->bubble = current_stage_x_register->bubble;
         return;
     }
     if (current_stage_m_register->tainted_executions > 0) {
         new_m_reg->tainted_executions = (uint8_t) (current_stage_m_register->tainted_executions - 1);
+        // flushed behind a mispredict, or behind a stalled access that is being replayed
+        new_m_reg->bubble = current_stage_m_register->wasStalled ? memory_stall_cause(current_stage_m_register) : (uint8_t) CPI_MISPREDICT;
+        if (pipeview != NULL) {
+            pipeview_note(current_stage_x_register->trace_id, PIPEVIEW_FLUSH, new_m_reg->bubble);
+            pipeview_note(current_stage_x_register->trace_id2, PIPEVIEW_FLUSH, new_m_reg->bubble);
+        }
         return;
     }
     initialise();
@@ -1130,34 +1623,101 @@ void stage_execute (struct stage_reg_m* new_m_reg) {
     // printf("%08X\n", current_stage_x_register->pc);
     uint64_t pc = current_stage_x_register->pc + 4;
     major_dispatch_table[current_stage_x_register->instruction.data.u.opcode](&pc, current_stage_x_register->instruction, new_m_reg);
-    if (pc != current_stage_x_register->new_pc) { // mispredict
-        set_pc(pc);
+    uint64_t next_pc = pc;
+    new_m_reg->dual = 0;
+    new_m_reg->executed = 1;
+    memcpy(&new_m_reg->instruction, &current_stage_x_register->instruction, sizeof(new_m_reg->instruction));
+    new_m_reg->trace_id = current_stage_x_register->trace_id;
+    new_m_reg->trace_id2 = 0;
+    if (current_stage_x_register->dual && pc == current_stage_x_register->pc + 4) {
+        execute_second_slot(new_m_reg);
+        next_pc = pc + 4;
+        new_m_reg->executed = 2;
+        memcpy(&new_m_reg->instruction2, &current_stage_x_register->instruction2, sizeof(new_m_reg->instruction2));
+        new_m_reg->trace_id2 = current_stage_x_register->trace_id2;
+    } else if (current_stage_x_register->dual && pipeview != NULL) {
+        pipeview_note(current_stage_x_register->trace_id2, PIPEVIEW_FLUSH, CPI_MISPREDICT); // the first slot jumped
+    }
+    if (branch_trace != NULL || (plugin_hooks & PLUGIN_HOOK_BRANCH)) {
+        pending_trace_record.type = branch_type(new_m_reg->instruction);
+        pending_trace_record.pc = current_stage_x_register->pc;
+        pending_trace_record.target = pc;
+        pending_trace_record.taken = pc != current_stage_x_register->pc + 4;
+        trace_pending = (uint8_t) (pending_trace_record.type == BRANCH_NONE ? 1 : 2);
+        trace_pending_second = new_m_reg->dual;
+        trace_mispredicted = next_pc != current_stage_x_register->new_pc;
+    }
+    if (next_pc != current_stage_x_register->new_pc) { // mispredict, counted with the training
+        set_pc(next_pc);
+        execute_redirected = 1;
+        ras_repair(current_stage_x_register->ras_top, current_stage_x_register->ras_value, current_stage_x_register->pc, new_m_reg->instruction);
         new_m_reg->tainted_executions = 1;
     }
-    if (pc != current_stage_x_register->pc + 4) {
-        update_entry(current_stage_x_register->pc, pc, pc == current_stage_x_register->pc + 4);
+    training_conditional = current_stage_x_register->instruction.data.u.opcode == 0b1100011;
+    training_mispredicted = next_pc != current_stage_x_register->new_pc;
+    training_pending = training_conditional || current_stage_x_register->instruction.data.u.opcode == 0b1100111 ||
+                       pc != current_stage_x_register->pc + 4 || training_mispredicted;
+    training_instruction = new_m_reg->instruction;
+    training_path_history = current_stage_x_register->path_history;
+    training_pc = current_stage_x_register->pc;
+    training_target = pc;
+    training_bp_history = current_stage_x_register->bp_history;
+}
+
+// Counts the instructions in memory access as retired once it is done with them. One that stalled is finished from
+// its saved copy and then comes through again (see atomic_replayed), so only the pass that never stalled counts.
+void retire_memory_stage(struct stage_reg_w* new_w_reg) {
+    if (pipeview != NULL && current_stage_m_register->executed) {
+        new_w_reg->trace_id = current_stage_m_register->trace_id;
+        new_w_reg->trace_id2 = current_stage_m_register->executed == 2 ? current_stage_m_register->trace_id2 : 0;
+        if (current_stage_m_register->wasStalled) {
+            pipeview_replayed(new_w_reg->trace_id);
+        } else {
+            pipeview_retired(new_w_reg->trace_id);
+            pipeview_retired(new_w_reg->trace_id2);
+        }
+    }
+    if (!current_stage_m_register->wasStalled) {
+        pipeline_events.instructions_retired += current_stage_m_register->executed;
+        if ((plugin_hooks & PLUGIN_HOOK_RETIRE) && current_stage_m_register->executed) {
+            plugin_retire(current_stage_m_register->pc, current_stage_m_register->instruction);
+            if (current_stage_m_register->executed == 2) {
+                plugin_retire(current_stage_m_register->pc + 4, current_stage_m_register->instruction2);
+            }
+        }
     }
 }
 
-void stage_memory (struct stage_reg_w *new_w_reg) {
-    initialise();
+void stage_memory_access (struct stage_reg_w *new_w_reg) {
     // printf("mem %08X\n", current_stage_m_register->address);
+    new_w_reg->trace_id = 0;
+    new_w_reg->trace_id2 = 0;
     if (current_stage_w_register->tainted_executions > 0) {
+        if (pipeview != NULL && current_stage_m_register->executed) {
+            uint8_t cause = memory_stall_cause(&current_stage_w_register->memory_register);
+            pipeview_note(current_stage_m_register->trace_id, PIPEVIEW_FLUSH, cause);
+            pipeview_note(current_stage_m_register->trace_id2, PIPEVIEW_FLUSH, cause);
+        }
         new_w_reg->value = 0;
         new_w_reg->reg = 0;
         new_w_reg->op = 0;
+        new_w_reg->op2 = 0;
         new_w_reg->global_memory_stall = 0;
         new_w_reg->tainted_executions = (uint8_t) (current_stage_w_register->tainted_executions - 1);
         return;
     }
     new_w_reg->tainted_executions = 0;
+    new_w_reg->op2 = current_stage_m_register->dual; // never paired with a memory access, so never stalls
+    new_w_reg->reg2 = current_stage_m_register->reg2;
+    new_w_reg->value2 = current_stage_m_register->value2;
     if (current_stage_m_register->readWrite == 3) { // register write data forward
         new_w_reg->reg = current_stage_m_register->reg;
         new_w_reg->value = current_stage_m_register->value;
         new_w_reg->op = 1;
         new_w_reg->global_memory_stall = 0;
+        retire_memory_stage(new_w_reg);
         return;
-    } else if (current_stage_m_register->readWrite == 2) { // memory read, write to register
+    } else if (current_stage_m_register->readWrite == 2 || current_stage_m_register->readWrite == 4) { // memory read (or atomic), write to register
         uint32_t physical_address = 0;
         uint8_t status = get_address(&dtlb, (uint32_t) current_stage_m_register->address, &physical_address, current_stage_m_register->wasStalled ? current_stage_m_register->stallStatus : (uint8_t) 0xFF);
 
@@ -1177,7 +1737,24 @@ void stage_memory (struct stage_reg_w *new_w_reg) {
             return;
         }
 
-        uint8_t missed = read_access(&data_cache, physical_address, current_stage_m_register->size, &new_w_reg->value, current_stage_m_register->wasStalled == 1, memory_read_available);
+        uint8_t is_followup = current_stage_m_register->wasStalled == 1 && current_stage_m_register->stallStatus == 0xFF;
+        uint8_t missed;
+        if (current_stage_m_register->readWrite == 4 && atomic_replayed && atomic_replayed_pc == current_stage_m_register->pc) {
+            atomic_replayed = 0;
+            new_w_reg->value = atomic_replayed_value;
+            missed = 0;
+        } else if (current_stage_m_register->readWrite == 4) {
+            struct atomic_update update;
+            prepare_atomic_update(current_stage_m_register->amo, current_stage_m_register->value, current_stage_m_register->size, &update);
+            missed = atomic_access(&data_cache, physical_address, &update, &new_w_reg->value, is_followup, memory_read_available);
+            if (!missed && current_stage_m_register->wasStalled) {
+                atomic_replayed = 1;
+                atomic_replayed_pc = current_stage_m_register->pc;
+                atomic_replayed_value = new_w_reg->value;
+            }
+        } else {
+            missed = read_access(&data_cache, physical_address, current_stage_m_register->size, &new_w_reg->value, is_followup, memory_read_available);
+        }
         if (missed) {
             new_w_reg->global_memory_stall = (uint8_t) (missed == 2 ? 4 : 1);
             new_w_reg->value = 0;
@@ -1194,9 +1771,16 @@ void stage_memory (struct stage_reg_w *new_w_reg) {
                 new_w_reg->value = new_w_reg->value | ((uint64_t) 0xFF << (uint64_t) (8 * i));
             }
         }
-        new_w_reg->reg = current_stage_m_register->reg;
-        new_w_reg->op = 1;
+        // the copy of a stalled access leaves the register (and forwarding it) to its replay, which would otherwise
+        // see the loaded value in place of its base address when rd is rs1
+        new_w_reg->reg = current_stage_m_register->wasStalled ? 0 : current_stage_m_register->reg;
+        new_w_reg->op = (uint8_t) !current_stage_m_register->wasStalled;
         new_w_reg->global_memory_stall = 0;
+        if ((plugin_hooks & PLUGIN_HOOK_MEMORY) && !current_stage_m_register->wasStalled) {
+            plugin_memory(current_stage_m_register->pc, current_stage_m_register->address, physical_address, current_stage_m_register->size,
+                          (uint8_t) (current_stage_m_register->readWrite == 4 ? PLUGIN_ATOMIC : PLUGIN_LOAD));
+        }
+        retire_memory_stage(new_w_reg);
         return;
     } else if (current_stage_m_register->readWrite == 1) { // memory write value
         uint32_t physical_address = 0;
@@ -1218,31 +1802,138 @@ void stage_memory (struct stage_reg_w *new_w_reg) {
             return;
         }
 
-        uint8_t missed = write_access(&data_cache, physical_address, current_stage_m_register->value, current_stage_m_register->size, current_stage_m_register->wasStalled == 1, memory_read_available);
+        uint8_t missed;
+        if (store_replayed && store_replayed_pc == current_stage_m_register->pc) {
+            store_replayed = 0;
+            missed = 0;
+        } else {
+            missed = write_access(&data_cache, physical_address, current_stage_m_register->value, current_stage_m_register->size, current_stage_m_register->wasStalled == 1 && current_stage_m_register->stallStatus == 0xFF, memory_read_available);
+            if (!missed && current_stage_m_register->wasStalled) {
+                store_replayed = 1;
+                store_replayed_pc = current_stage_m_register->pc;
+            }
+        }
         if (missed) {
             new_w_reg->global_memory_stall = (uint8_t) (missed == 2 ? 5 : 1);
             new_w_reg->value = 0;
             new_w_reg->reg = 0;
             new_w_reg->op = 0;
             new_w_reg->tainted_executions = 1;
-            new_w_reg->tainted_executions = 0;
             memcpy(&new_w_reg->memory_register, current_stage_m_register, sizeof(struct stage_reg_m));
             new_w_reg->memory_register.wasStalled = missed == 2 ? 2 : 1;
             new_w_reg->memory_register.stallStatus = 0xFF;
             return;
         }
+        if ((plugin_hooks & PLUGIN_HOOK_MEMORY) && !current_stage_m_register->wasStalled) {
+            plugin_memory(current_stage_m_register->pc, current_stage_m_register->address, physical_address, current_stage_m_register->size, PLUGIN_STORE);
+        }
     } // else nop
     new_w_reg->value = 0;
     new_w_reg->reg = 0;
     new_w_reg->op = 0;
     new_w_reg->global_memory_stall = 0;
+    retire_memory_stage(new_w_reg);
+}
+
+void stage_memory (struct stage_reg_w *new_w_reg) {
+    initialise();
+    if (sim_config.core_type == CORE_OUT_OF_ORDER) {
+        ooo_memory();
+    } else {
+        stage_memory_access(new_w_reg);
+        if (profiling) {
+            profile_memory(current_stage_m_register->pc);
+        }
+        pipeline_events.cpi_cycles[memory_cycle_cause(new_w_reg)]++;
+        if (pipeview != NULL && new_w_reg->global_memory_stall) {
+            pipeview_note(new_w_reg->memory_register.trace_id, PIPEVIEW_STALL, memory_stall_cause(&new_w_reg->memory_register));
+        }
+        if (new_w_reg->global_memory_stall || current_stage_w_register->tainted_executions) { // waiting, or the cycle after
+            pipeline_events.memory_stall_cycles++;
+        }
+    }
+    drain_write_buffer(&data_cache); // uses the memory port only if the access above left it idle
+}
+
+// The oldest instruction still in flight, which the profile charges the cycle to: one waiting on memory access, else
+// the oldest of memory access, execute and decode holding one, else the one being fetched
+uint64_t oldest_in_flight_pc() {
+    if (sim_config.core_type == CORE_OUT_OF_ORDER) {
+        return ooo_oldest_pc();
+    }
+    if (current_stage_w_register->global_memory_stall) {
+        return current_stage_w_register->memory_register.pc;
+    }
+    if (current_stage_m_register->executed) {
+        return current_stage_m_register->pc;
+    }
+    if (current_stage_x_register->not_stalled) {
+        return current_stage_x_register->pc;
+    }
+    if (current_stage_d_register->not_stalled) {
+        return current_stage_d_register->pc;
+    }
+    return get_pc();
+}
+
+// Reports where every traced instruction is at the start of the cycle; one waiting on memory access sits in writeback
+// as the copy it will be replayed from
+void pipeview_occupancy() {
+    pipeview_begin_cycle();
+    if (sim_config.core_type == CORE_OUT_OF_ORDER) {
+        ooo_pipeview();
+    } else {
+        if (current_stage_d_register->not_stalled) {
+            pipeview_stage(current_stage_d_register->trace_id, "D");
+            if (current_stage_d_register->dual) {
+                pipeview_stage(current_stage_d_register->trace_id2, "D");
+            }
+        }
+        if (current_stage_x_register->not_stalled) {
+            pipeview_stage(current_stage_x_register->trace_id, "X");
+            if (current_stage_x_register->dual) {
+                pipeview_stage(current_stage_x_register->trace_id2, "X");
+            }
+        }
+        if (current_stage_m_register->executed) {
+            pipeview_stage(current_stage_m_register->trace_id, "M");
+            if (current_stage_m_register->executed == 2) {
+                pipeview_stage(current_stage_m_register->trace_id2, "M");
+            }
+        }
+        if (current_stage_w_register->global_memory_stall) {
+            pipeview_stage(current_stage_w_register->memory_register.trace_id, "M");
+        }
+        pipeview_stage(current_stage_w_register->trace_id, "W");
+        pipeview_stage(current_stage_w_register->trace_id2, "W");
+    }
+    pipeview_end_cycle();
 }
 
 void stage_writeback () {
-    if (!current_stage_w_register->op) {
+    if (profiling) {
+        profile_cycle(oldest_in_flight_pc());
+    }
+    if (pipeview != NULL) {
+        pipeview_occupancy();
+    }
+    if (interval_output != NULL) {
+        interval_stats_cycle();
+    }
+    if (sim_config.core_type == CORE_OUT_OF_ORDER) {
+        initialise();
+        ooo_commit();
+        return;
+    }
+    if (!current_stage_w_register->op && !current_stage_w_register->op2) {
         return;
     }
     initialise();
-    register_write(current_stage_w_register->reg, current_stage_w_register->value);
+    if (current_stage_w_register->op) {
+        register_write(current_stage_w_register->reg, current_stage_w_register->value);
+    }
+    if (current_stage_w_register->op2) {
+        register_write(current_stage_w_register->reg2, current_stage_w_register->value2);
+    }
 }
 
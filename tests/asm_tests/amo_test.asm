@@ -0,0 +1,25 @@
+# Tests AMOs: .w results are sign extended, min/max compare signed, minu/maxu unsigned
+
+li t0, 0x2600
+li t1, -2
+sw t1, (t0)
+li t2, 3
+li t3, -5
+amoadd.w a0, t2, (t0)
+amomin.w a1, t2, (t0)
+amomin.w a2, t3, (t0)
+amominu.w a3, t2, (t0)
+amomax.w a4, t3, (t0)
+amomaxu.w a5, t3, (t0)
+lw a6, (t0)
+addi t4, t0, 8
+li t5, 0xF0F
+sd t5, (t4)
+amoor.d s0, t2, (t4)
+amoand.d s1, t2, (t4)
+amoxor.d s2, t3, (t4)
+amoswap.d s3, t2, (t4)
+ld s4, (t4)
+
+# Expected results: a0 = -2, a1 = 1, a2 = 1, a3 = -5, a4 = 3, a5 = 3, a6 = -5,
+# s0 = 0xf0f, s1 = 0xf0f, s2 = 3, s3 = -8, s4 = 3
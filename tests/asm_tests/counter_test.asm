@@ -0,0 +1,32 @@
+# Tests reading the cycle and instret counters and programming an hpm counter through mhpmevent
+
+rdcycle t0
+rdinstret t1
+addi t6, zero, 1
+addi t6, t6, 1
+addi t6, t6, 1
+rdinstret t2
+rdcycle t3
+# only timing independent facts are kept, the raw counts differ between the in-order and out-of-order cores
+sub t2, t2, t1
+addi t2, t2, -4
+seqz t2, t2 # instret delta is exact
+sltu t4, t0, t3 # cycle went up
+li t0, 0
+li t1, 0
+li t3, 0
+csrrwi zero, mhpmevent3, 2 # D-Cache misses
+csrr a0, mhpmevent3
+csrw mhpmcounter3, zero
+li s0, 0x2700
+ld s1, (s0)
+ld s1, 256(s0)
+csrr a1, hpmcounter3
+csrrsi a2, mhpmevent3, 4 # event 6, fetch stall cycles
+csrrci a3, mhpmevent3, 2 # event 4, D-TLB misses
+csrr a3, mhpmevent3
+li t5, 9
+csrw mhpmevent4, t5 # no such event
+csrr a4, mhpmevent4
+
+# Expected results: t2 = 1, t4 = 1, a0 = 2, a1 = 2, a2 = 2, a3 = 4, a4 = 0
@@ -0,0 +1,22 @@
+# Tests load-reserved / store-conditional success and failure
+
+li t0, 0x2500
+li t1, 5
+sd t1, (t0)
+lr.d t2, (t0)
+addi t2, t2, 1
+sc.d t3, t2, (t0) # reserved, succeeds
+sc.d t4, t1, (t0) # the reservation was used up, fails
+ld t5, (t0)
+lr.w t6, (t0)
+addi a1, t0, 64
+sc.w a0, t1, (a1) # another block, fails and drops the reservation
+sc.w a2, t1, (t0)
+lw a3, (t0)
+li a5, 0x80000000
+sw a5, (t0)
+lr.w a4, (t0) # sign extended
+sc.w a5, zero, (t0)
+lw a6, (t0)
+
+# Expected results: t2 = 6, t3 = 0, t4 = 1, t5 = 6, t6 = 6, a0 = 1, a2 = 1, a3 = 6, a4 = 0xffffffff80000000, a5 = 0, a6 = 0
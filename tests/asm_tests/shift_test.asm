@@ -0,0 +1,13 @@
+# Tests RV64 immediate shifts by 32 or more, whose shamt reaches into funct7
+
+li t0, -8
+slli t1, t0, 33
+srli t2, t0, 33
+srai t3, t0, 33
+slli t4, t0, 63
+srli t5, t0, 63
+srai t6, t1, 62
+sraiw a0, t1, 31
+
+# Expected results: t0 = 0xFFFFFFFFFFFFFFF8, t1 = 0xFFFFFFF000000000, t2 = 0x7FFFFFFF, t3 = 0xFFFFFFFFFFFFFFFF,
+# t4 = 0, t5 = 1, t6 = 0xFFFFFFFFFFFFFFFF, a0 = 0
@@ -0,0 +1,17 @@
+# Tests a load on the wrong path of a mispredicted branch whose address is not mapped. The loads the branch depends
+# on miss in the D-cache, so the out-of-order core can start the unmapped load before the branch resolves; its page
+# walk must not hold the D-cache port the loads after the branch need
+
+li t0, 0x10000000 # no page table entry
+li s0, 0x2700
+ld a1, 0(s0) # misses, a1 = 0
+add a0, s0, a1
+ld t2, 0(a0) # t2 = 0
+beqz t2, skip
+ld t3, 0(t0)
+addi t3, t3, 1
+skip:
+ld t4, 256(s0) # t4 = 0, needs the D-cache again
+addi t5, t4, 2
+
+# Expected results: t0 = 0x10000000, s0 = a0 = 0x2700, t3 = 0, t4 = 0, t5 = 2
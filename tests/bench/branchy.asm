@@ -0,0 +1,69 @@
+# Benchmark: 100000 iterations of data-dependent branches, a call and return and a jump table, all driven by a
+# 64-bit linear congruential generator
+
+.section .text
+.globl   _start
+_start:
+
+li s0, 100000
+li s1, 6364136223846793005
+li s2, 1442695040888963407
+li s3, 0
+li a0, 0
+li a1, 0
+li a2, 0
+li a3, 0
+loop:
+	mul s3, s3, s1
+	add s3, s3, s2
+	srli t0, s3, 33
+	andi t1, t0, 1
+	beqz t1, even
+	addi a0, a0, 1
+	j parity_done
+even:
+	addi a1, a1, 1
+parity_done:
+	andi t1, t0, 6
+	bnez t1, no_call
+	jal ra, leaf
+no_call:
+	andi t1, t0, 0x30
+	srli t1, t1, 2
+	jal t2, dispatch
+table:
+	j case0
+	j case1
+	j case2
+	j case3
+dispatch:
+	add t2, t2, t1
+	jr t2
+case0:
+	addi a2, a2, 1
+	j next
+case1:
+	addi a2, a2, 2
+	j next
+case2:
+	xor a2, a2, t0
+	j next
+case3:
+	sub a2, a2, t0
+next:
+	addi s0, s0, -1
+	bnez s0, loop
+# the pipeline drains on these, a run stops as soon as fetch reaches the ebreak
+nop
+nop
+nop
+nop
+nop
+nop
+ebreak
+
+leaf:
+	add a3, a3, t0
+	ret
+
+# Expected results: a0 + a1 = 100000 (100000 = 0x186A0), s0 = 0
@@ -0,0 +1,68 @@
+# Benchmark: multiplies two 32x32 matrices of doublewords 4 times, C = A * B
+# A at 0x20000 with A[i][j] = i + j, B at 0x30000 with B[i][j] = i - j, C at 0x40000
+
+.section .text
+.globl   _start
+_start:
+
+li s0, 0x20000
+li s1, 0x30000
+li s2, 0x40000
+li s3, 32
+li t0, 0
+mv t4, s0
+mv t5, s1
+init_row:
+	li t1, 0
+init_column:
+	add t2, t0, t1
+	sd t2, 0(t4)
+	sub t2, t0, t1
+	sd t2, 0(t5)
+	addi t4, t4, 8
+	addi t5, t5, 8
+	addi t1, t1, 1
+	bne t1, s3, init_column
+	addi t0, t0, 1
+	bne t0, s3, init_row
+
+li s4, 4
+pass:
+	li t0, 0
+	mv a5, s2
+row:
+	li t1, 0
+column:
+	slli a0, t0, 8
+	add a0, a0, s0
+	slli a1, t1, 3
+	add a1, a1, s1
+	li t2, 0
+	li a4, 0
+dot:
+	ld a2, 0(a0)
+	ld a3, 0(a1)
+	mul a2, a2, a3
+	add a4, a4, a2
+	addi a0, a0, 8
+	addi a1, a1, 256
+	addi t2, t2, 1
+	bne t2, s3, dot
+	sd a4, 0(a5)
+	addi a5, a5, 8
+	addi t1, t1, 1
+	bne t1, s3, column
+	addi t0, t0, 1
+	bne t0, s3, row
+	addi s4, s4, -1
+	bnez s4, pass
+# the pipeline drains on these, a run stops as soon as fetch reaches the ebreak
+nop
+nop
+nop
+nop
+nop
+nop
+ebreak
+
+# Expected results: a4 = C[31][31] = 0xFFFFFFFFFFFFB090, s4 = 0
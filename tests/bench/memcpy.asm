@@ -0,0 +1,48 @@
+# Benchmark: copies a 64KB buffer 64 times, four doublewords per iteration
+# Source at 0x20000, destination at 0x40000
+
+.section .text
+.globl   _start
+_start:
+
+li s0, 0x20000
+li s1, 0x40000
+li s2, 0x10000
+mv t0, s0
+add t1, s0, s2
+li t2, 0x0123456789ABCDEF
+fill:
+	sd t2, 0(t0)
+	addi t2, t2, 1
+	addi t0, t0, 8
+	bne t0, t1, fill
+
+li s3, 64
+pass:
+	mv t0, s0
+	mv t1, s1
+	add t3, s0, s2
+copy:
+	ld a0, 0(t0)
+	ld a1, 8(t0)
+	ld a2, 16(t0)
+	ld a3, 24(t0)
+	sd a0, 0(t1)
+	sd a1, 8(t1)
+	sd a2, 16(t1)
+	sd a3, 24(t1)
+	addi t0, t0, 32
+	addi t1, t1, 32
+	bne t0, t3, copy
+	addi s3, s3, -1
+	bnez s3, pass
+# the pipeline drains on these, a run stops as soon as fetch reaches the ebreak
+nop
+nop
+nop
+nop
+nop
+nop
+ebreak
+
+# Expected results: a3 = 0x0123456789ABEDEE, s3 = 0
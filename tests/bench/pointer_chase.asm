@@ -0,0 +1,39 @@
+# Benchmark: follows a linked list of 8192 nodes, one per 64 byte block, 262144 times
+# Node i at 0x80000 + i * 64 points to node (i + 2731) mod 8192, so every load depends on the one before and lands
+# on another page
+
+.section .text
+.globl   _start
+_start:
+
+li s0, 0x80000
+li s1, 8191
+li s2, 2731
+li t0, 0
+link:
+	add t1, t0, s2
+	and t1, t1, s1
+	slli t2, t0, 6
+	add t2, t2, s0
+	slli t3, t1, 6
+	add t3, t3, s0
+	sd t3, 0(t2)
+	mv t0, t1
+	bnez t0, link
+
+mv a0, s0
+li s3, 262144
+chase:
+	ld a0, 0(a0)
+	addi s3, s3, -1
+	bnez s3, chase
+# the pipeline drains on these, a run stops as soon as fetch reaches the ebreak
+nop
+nop
+nop
+nop
+nop
+nop
+ebreak
+
+# Expected results: a0 = 0x80000 (262144 is a multiple of 8192), s3 = 0
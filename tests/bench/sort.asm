@@ -0,0 +1,45 @@
+# Benchmark: insertion sort of 1024 pseudo-random words at 0x20000
+
+.section .text
+.globl   _start
+_start:
+
+li s0, 0x20000
+li s1, 0x21000
+li t0, 12345
+li t3, 1103515245
+li t4, 12345
+mv t1, s0
+fill:
+	mul t0, t0, t3
+	add t0, t0, t4
+	srli t5, t0, 16
+	sw t5, 0(t1)
+	addi t1, t1, 4
+	bne t1, s1, fill
+
+addi t1, s0, 4
+outer:
+	lw a0, 0(t1)
+	mv t2, t1
+inner:
+	beq t2, s0, place
+	lw a1, -4(t2)
+	ble a1, a0, place
+	sw a1, 0(t2)
+	addi t2, t2, -4
+	j inner
+place:
+	sw a0, 0(t2)
+	addi t1, t1, 4
+	bne t1, s1, outer
+# the pipeline drains on these, a run stops as soon as fetch reaches the ebreak
+nop
+nop
+nop
+nop
+nop
+nop
+ebreak
+
+# Expected results: the words at 0x20000 in ascending (signed) order, t1 = 0x21000
@@ -0,0 +1,34 @@
+# Benchmark: reads and writes one word in each of 256 16KB pages, 256 times, far more pages than the TLBs hold
+# The pages are the second 4MB region, 0x400000 to 0x7FFFFF; each pass moves 64 bytes further into every page
+
+.section .text
+.globl   _start
+_start:
+
+li s0, 0x400000
+li s1, 0x4000
+li s2, 256
+li t3, 0
+pass:
+	add t0, s0, t3
+	li t1, 256
+page:
+	lw a0, 0(t0)
+	addi a0, a0, 1
+	sw a0, 0(t0)
+	add t0, t0, s1
+	addi t1, t1, -1
+	bnez t1, page
+	addi t3, t3, 64
+	addi s2, s2, -1
+	bnez s2, pass
+# the pipeline drains on these, a run stops as soon as fetch reaches the ebreak
+nop
+nop
+nop
+nop
+nop
+nop
+ebreak
+
+# Expected results: a0 = 4 (the region's 256 virtual pages share 64 physical ones), s2 = 0
@@ -0,0 +1,32 @@
+#!/bin/bash
+# Simulator speed: runs each bench/*.asm.bin to its ebreak and prints one CSV line per workload with the simulated
+# instructions and cycles, the host time of the whole simulator run, and instructions (KIPS, MIPS) and cycles
+# simulated per host second.
+# usage: ./run_bench.sh [simulator]
+# Commands in $BENCH_CONFIG (e.g. "config core_type 1") are given before the run.
+# bench/pt_bench maps the first 1MB (0x0 - 0xFFFFF) to itself and the 256 16KB pages of 0x400000 - 0x7FFFFF onto
+# the 64 physical pages of 0x400000 - 0x4FFFFF; the workloads are loaded at 0x1000.
+SIM=${1:-../build/riscvsim}
+
+echo "workload,instructions,cycles,ipc,host_seconds,kips,mips,cycles_per_second"
+for file in bench/*.asm.bin; do
+    start=$(date +%s%N)
+    out=$($SIM 2>/dev/null << EOF
+load /x 0x0 ./bench/pt_bench
+setptbr 0x8000
+load 0x1000 $file
+setpc 0x1000
+$BENCH_CONFIG
+run 100000000
+cpistack
+EOF
+)
+    end=$(date +%s%N)
+    # "Cycles: <cycles>, instructions: <instructions>, CPI: ..."
+    counts=$(echo "$out" | sed -n 's/.*Cycles: \([0-9]*\), instructions: \([0-9]*\),.*/\1 \2/p')
+    echo "$counts" | awk -v name="$(basename $file .asm.bin)" -v ns=$((end - start)) '{
+        seconds = ns / 1e9
+        printf "%s,%d,%d,%.4f,%.4f,%.1f,%.3f,%.0f\n", name, $2, $1, $1 ? $2 / $1 : 0, seconds,
+               $2 / seconds / 1e3, $2 / seconds / 1e6, $1 / seconds
+    }'
+done